@@ -32,6 +32,46 @@ struct BRANCH_POINT
 
 typedef struct BRANCH_POINT BranchPoint;
 
+// an instruction pulled apart again for the optimizer
+struct DECODED
+{
+  unsigned char opcode;
+  unsigned char mode;
+  unsigned char reg1;
+  unsigned char reg2;     // the 2nd operand as a register
+  char          literal;  // or as a literal, sign extended
+  bool          target;   // a label points at it, so it can be branched to
+  bool          removed;
+};
+
+typedef struct DECODED Decoded;
+
+// where an instruction came from, for the line map the simulator's profiler reads
+struct SOURCE_LINE
+{
+  int  line;                // the line number in the .asm, from 1
+  char label[LABEL_SIZE];   // the closest label at or before it, "-" if there isn't one
+};
+
+typedef struct SOURCE_LINE SourceLine;
+
+// a region of data memory the program wants in the scratchpad, from a .scratchpad directive
+struct REGION
+{
+  int first;   // the word address it starts at
+  int words;
+};
+
+typedef struct REGION Region;
+
+// the MOVE mode for MOVB, a block move
+#define BLOCK_MOVE_MODE 0x07
+
+// the mode bits for the packed instructions (PADD, PADDS, PSUB, PSUBS, PAND, POR and PXOR), and for the
+// saturating adds and subtracts among them
+#define PACKED_MODE   0x02
+#define SATURATE_MODE 0x04
+
 // constants for our processor definition
 #define WORD_SIZE     2
 #define DATA_SIZE     1024*WORD_SIZE
@@ -80,6 +120,93 @@ void create_object_file( char *filename, unsigned char *data, int length )
 }
 
 
+// writes the line map next to the object file, a line for each instruction with its address
+// (in instructions, like the simulator's PC), the source line it came from and the label it's under
+void create_map_file( char *filename, vector<SourceLine> &lines )
+{
+  FILE *map_file = NULL;
+  string map_filename( filename, strlen(filename)-3 );
+  int i;
+
+  map_filename += "lines";
+  map_file = fopen( map_filename.c_str(), "w" );
+
+  if ( map_file )
+  {
+    for ( i=0 ; i<(int)lines.size() ; i++ )
+      fprintf( map_file, "%04x %d %s\n", i, lines[i].line, lines[i].label );
+
+    fclose( map_file );
+  }
+}
+
+
+// a directive is a line whose first word starts with a '.', it tells the assembler something
+// rather than being an instruction
+bool is_directive( const char *line )
+{
+  while ( *line == ' ' || *line == '\t' )
+    line++;
+
+  return *line == '.';
+}
+
+
+// pulls the .scratchpad <address>,<words> directives out of the source, the regions of data memory
+// (in words) the simulator should keep in its scratchpad instead of going through the cache
+// returns false (after saying why) if one of them can't be read
+bool find_scratchpad( vector<string> &source_text, vector<Region> &regions )
+{
+  bool rc = true;
+  int i;
+  char directive[LABEL_SIZE];
+  Region region;
+
+  for ( i=0 ; i<(int)source_text.size() ; i++ )
+  {
+    if ( !is_directive( source_text[i].c_str() ) )
+      continue;
+
+    if ( sscanf( source_text[i].c_str(), " %27s %d , %d", directive, &region.first, &region.words ) == 3 &&
+         strcmp( directive, ".scratchpad" ) == 0 && region.first >= 0 && region.words > 0 )
+      regions.push_back( region );
+    else
+    {
+      printf( "line %d: expected .scratchpad <address>,<words>\n", i + 1 );
+      rc = false;
+    }
+  }
+
+  return rc;
+}
+
+
+// writes the scratchpad regions next to the object file, a line for each with its first word address
+// (in hex) and its length in words. without any the old file is removed so it doesn't get used by mistake
+void create_scratchpad_file( char *filename, vector<Region> &regions )
+{
+  FILE *pad_file = NULL;
+  string pad_filename( filename, strlen(filename)-3 );
+  int i;
+
+  pad_filename += "pad";
+  if ( regions.empty() )
+  {
+    remove( pad_filename.c_str() );
+    return;
+  }
+
+  pad_file = fopen( pad_filename.c_str(), "w" );
+  if ( pad_file )
+  {
+    for ( i=0 ; i<(int)regions.size() ; i++ )
+      fprintf( pad_file, "%04x %d\n", regions[i].first, regions[i].words );
+
+    fclose( pad_file );
+  }
+}
+
+
 // takes the data and prints it out in hexadecimal and ASCII form
 void print_formatted_data( unsigned char *data, int length )
 {
@@ -121,22 +248,30 @@ unsigned char get_opcode( char *operation )
 {
   unsigned char opcode = '\0';
   
-  if ( strcmp( operation, "ADD" ) == 0 )
+  if ( strcmp( operation, "ADD" ) == 0  ||
+      strcmp( operation, "PADD" ) == 0 ||
+      strcmp( operation, "PADDS" ) == 0 )
     opcode = ADD_OPCODE;
   
-  else if ( strcmp( operation, "SUB" ) == 0 )
+  else if ( strcmp( operation, "SUB" ) == 0  ||
+           strcmp( operation, "PSUB" ) == 0 ||
+           strcmp( operation, "PSUBS" ) == 0 )
     opcode = SUB_OPCODE;
   
-  else if ( strcmp( operation, "AND" ) == 0 )
+  else if ( strcmp( operation, "AND" ) == 0 ||
+           strcmp( operation, "PAND" ) == 0 )
     opcode = AND_OPCODE;
   
-  else if ( strcmp( operation, "OR" ) == 0 )
+  else if ( strcmp( operation, "OR" ) == 0 ||
+           strcmp( operation, "POR" ) == 0 )
     opcode = OR_OPCODE;
   
-  else if ( strcmp( operation, "XOR" ) == 0 )
+  else if ( strcmp( operation, "XOR" ) == 0 ||
+           strcmp( operation, "PXOR" ) == 0 )
     opcode = XOR_OPCODE;
   
-  else if ( strcmp( operation, "MOVE" ) == 0 )
+  else if ( strcmp( operation, "MOVE" ) == 0 ||
+           strcmp( operation, "MOVB" ) == 0 )
     opcode = MOVE_OPCODE;
   
   else if ( strcmp( operation, "SRL" ) == 0 ||
@@ -169,6 +304,21 @@ unsigned char get_opcode_type( unsigned char opcode, char * operation,
     // need to indicate if the 2nd operand is a register
     if ( operand2[0] == 'R' )
       type = 0x01;
+    
+    // and if it works on the bytes separately
+    if ( operation[0] == 'P' )
+      type |= PACKED_MODE;
+    if ( strcmp( operation, "PADDS" ) == 0 || strcmp( operation, "PSUBS" ) == 0 )
+      type |= SATURATE_MODE;
+  }
+  
+  // a block move is always memory to memory, which a plain move can't be
+  else if ( strcmp( operation, "MOVB" ) == 0 )
+  {
+    if ( operand1[0] == '[' && operand2 && operand2[0] == '[' )
+      type = 0x07;
+    else
+      type = 0x02;
   }
   
   else if ( opcode == MOVE_OPCODE )
@@ -299,10 +449,373 @@ void fix_branches( unsigned char *machine_code,
 }
 
 
+// puts a decoded instruction back together
+void encode_instruction( Decoded *instr, unsigned char *machine_code )
+{
+  machine_code[0] = (instr->opcode << 5) | (instr->mode << 2) | (instr->reg1 >> 2);
+  machine_code[1] = (instr->reg1 & 0x03) << 6;
+
+  // a literal takes the whole 6 bits, a register is followed by 2 unused ones.
+  // shifts have no 2nd operand and branches get theirs later
+  if ( (instr->opcode <= MOVE_OPCODE) && (instr->mode & 0x01) == 0 )
+    machine_code[1] |= instr->literal & 0x3F;
+  else if ( instr->opcode <= MOVE_OPCODE )
+    machine_code[1] |= instr->reg2 << 2;
+}
+
+
+// what an instruction does with the registers, for the optimizer
+// returns false if it isn't a valid instruction, which we treat as the end of the program
+bool register_usage( Decoded *instr, unsigned short &uses, unsigned short &defines )
+{
+  bool valid = true;
+
+  uses = 0;
+  defines = 0;
+
+  if ( instr->opcode <= XOR_OPCODE || instr->opcode == SHIFT_OPCODE )
+  {
+    // only adds and subtracts saturate
+    if ( instr->opcode == SHIFT_OPCODE )
+      valid = instr->mode <= 1;
+    else if ( instr->mode & SATURATE_MODE )
+      valid = (instr->mode & PACKED_MODE) && instr->opcode <= SUB_OPCODE;
+    uses = 1 << instr->reg1;
+    defines = 1 << instr->reg1;
+    if ( (instr->mode & 0x01) && instr->opcode != SHIFT_OPCODE )
+      uses |= 1 << instr->reg2;
+  }
+
+  else if ( instr->opcode == MOVE_OPCODE )
+  {
+    if ( instr->mode == 0 )
+      defines = 1 << instr->reg1;
+    else if ( instr->mode == 1 )
+    {
+      uses = 1 << instr->reg2;
+      defines = 1 << instr->reg1;
+    }
+    else if ( instr->mode == 4 )
+      uses = 1 << instr->reg1;
+    else if ( instr->mode == 5 )
+      uses = (1 << instr->reg1) | (1 << instr->reg2);
+    else if ( instr->mode == BLOCK_MOVE_MODE )
+      uses = (1 << instr->reg1) | (1 << instr->reg2) | 1;
+    else
+      valid = false;
+  }
+
+  // every branch but a jump compares with R0
+  else if ( instr->opcode == BRANCH_OPCODE )
+  {
+    valid = instr->mode != 0x07;
+    uses = 1 << instr->reg1;
+    if ( instr->mode != 0 )
+      uses |= 1;
+  }
+
+  return valid;
+}
+
+
+// works out what an arithmetic instruction leaves in its register when we know what the operands were,
+// the same way the simulator's ALU would
+unsigned short fold_constant( Decoded *instr, unsigned short x, unsigned short y )
+{
+  unsigned short z = 0;
+  int shift;
+  int c;
+
+  // a packed instruction works on each byte by itself, and a literal is used for both of them
+  if ( instr->opcode <= XOR_OPCODE && (instr->mode & PACKED_MODE) )
+  {
+    if ( (instr->mode & 0x01) == 0 )
+      y = (y & 0xFF) * 0x0101;
+
+    for ( shift=0 ; shift<16 ; shift+=8 )
+    {
+      Decoded byte = *instr;
+
+      byte.mode = 0;
+      c = fold_constant( &byte, (x >> shift) & 0xFF, (y >> shift) & 0xFF );
+      if ( c > 0xFF && (instr->mode & SATURATE_MODE) )
+        c = instr->opcode == ADD_OPCODE ? 0xFF : 0;
+      z |= (c & 0xFF) << shift;
+    }
+    return z;
+  }
+
+  switch ( instr->opcode )
+  {
+    case ADD_OPCODE:
+      z = (short)x + (short)y;
+      break;
+    case SUB_OPCODE:
+      z = (short)x - (short)y;
+      break;
+    case AND_OPCODE:
+      z = x & y;
+      break;
+    case OR_OPCODE:
+      z = x | y;
+      break;
+    case XOR_OPCODE:
+      z = x ^ y;
+      break;
+    case SHIFT_OPCODE:
+      z = instr->mode == 0 ? x >> 1 : x << 1;
+      break;
+  }
+
+  return z;
+}
+
+
+// one pass forwards through the code, a basic block at a time (a block ends at a branch and
+// starts at a label). it tracks which registers hold known constants and which hold what's in
+// memory at the address in another register, and uses that to
+// - remove moves of a literal into a register that already holds it
+// - turn arithmetic on known constants into a move of the result, if it fits in a literal
+// - remove loads of a value the register already holds (from a store or load at the same address)
+// returns the number of instructions changed
+int propagate_constants( vector<Decoded> &code )
+{
+  int changes = 0;
+  int i;
+  int r;
+  bool known[REGISTERS];
+  unsigned short value[REGISTERS];
+  int holds[REGISTERS];   // the register with the address whose memory this register holds, or -1
+  unsigned short uses;
+  unsigned short defines;
+  unsigned short result;
+  bool valid;
+
+  for ( i=0 ; i<(int)code.size() ; i++ )
+  {
+    Decoded *instr = &code[i];
+
+    if ( i == 0 || instr->target )
+    {
+      for ( r=0 ; r<REGISTERS ; r++ )
+      {
+        known[r] = false;
+        holds[r] = -1;
+      }
+    }
+
+    if ( instr->removed )
+      continue;
+
+    valid = register_usage( instr, uses, defines );
+
+    // a literal we already have
+    if ( valid && instr->opcode == MOVE_OPCODE && instr->mode == 0 &&
+         known[instr->reg1] && value[instr->reg1] == (unsigned short)instr->literal )
+    {
+      instr->removed = true;
+      changes++;
+      continue;
+    }
+
+    // a load of what's already there
+    if ( valid && instr->opcode == MOVE_OPCODE && instr->mode == 1 && holds[instr->reg1] == instr->reg2 )
+    {
+      instr->removed = true;
+      changes++;
+      continue;
+    }
+
+    // arithmetic we can do now
+    if ( valid && (instr->opcode <= XOR_OPCODE || instr->opcode == SHIFT_OPCODE) && known[instr->reg1] &&
+         ((instr->mode & 0x01) == 0 || instr->opcode == SHIFT_OPCODE || known[instr->reg2]) )
+    {
+      if ( instr->opcode == SHIFT_OPCODE )
+        result = fold_constant( instr, value[instr->reg1], 0 );
+      else
+        result = fold_constant( instr, value[instr->reg1],
+                               (instr->mode & 0x01) == 0 ? (unsigned short)instr->literal : value[instr->reg2] );
+
+      if ( (short)result >= -32 && (short)result <= 31 )
+      {
+        instr->opcode = MOVE_OPCODE;
+        instr->mode = 0;
+        instr->literal = (char)result;
+        changes++;
+      }
+
+      // even if it doesn't fit we still know what it is
+      known[instr->reg1] = true;
+      value[instr->reg1] = result;
+    }
+
+    else if ( valid && instr->opcode == MOVE_OPCODE && instr->mode == 0 )
+    {
+      known[instr->reg1] = true;
+      value[instr->reg1] = (unsigned short)instr->literal;
+    }
+
+    else
+    {
+      for ( r=0 ; r<REGISTERS ; r++ )
+      {
+        if ( defines & (1 << r) )
+          known[r] = false;
+      }
+    }
+
+    // anything that changes a register forgets what it held and what it was the address of
+    for ( r=0 ; r<REGISTERS ; r++ )
+    {
+      if ( (defines & (1 << r)) || (holds[r] >= 0 && (defines & (1 << holds[r]))) )
+        holds[r] = -1;
+    }
+
+    // a store changes memory, which might be anybody's, and a load tells us what's in memory
+    if ( valid && instr->opcode == MOVE_OPCODE && (instr->mode & 0x04) )
+    {
+      for ( r=0 ; r<REGISTERS ; r++ )
+        holds[r] = -1;
+      if ( instr->mode == 5 && instr->reg2 != instr->reg1 )
+        holds[instr->reg2] = instr->reg1;
+    }
+    else if ( valid && instr->opcode == MOVE_OPCODE && instr->mode == 1 && instr->reg1 != instr->reg2 )
+      holds[instr->reg1] = instr->reg2;
+
+    // nothing carries on past a branch or an invalid instruction
+    if ( !valid || instr->opcode == BRANCH_OPCODE )
+    {
+      for ( r=0 ; r<REGISTERS ; r++ )
+      {
+        known[r] = false;
+        holds[r] = -1;
+      }
+    }
+  }
+
+  return changes;
+}
+
+
+// one pass backwards through the code removing register writes that are overwritten before anything
+// reads them. every register is assumed to be needed at the end of a basic block, and loads are never
+// removed since they might be the access that stops the program
+// returns the number of instructions removed
+int remove_dead_writes( vector<Decoded> &code )
+{
+  int changes = 0;
+  int i;
+  unsigned short live = 0xFFFF;
+  unsigned short uses;
+  unsigned short defines;
+  bool valid;
+
+  for ( i=(int)code.size()-1 ; i>=0 ; i-- )
+  {
+    Decoded *instr = &code[i];
+
+    if ( !instr->removed )
+    {
+      valid = register_usage( instr, uses, defines );
+
+      // the end of a block
+      if ( !valid || instr->opcode == BRANCH_OPCODE )
+        live = 0xFFFF;
+
+      if ( valid && instr->opcode != BRANCH_OPCODE && !(instr->opcode == MOVE_OPCODE && instr->mode != 0) &&
+           (live & defines) == 0 )
+      {
+        instr->removed = true;
+        changes++;
+      }
+      else
+        live = (live & ~defines) | uses;
+    }
+
+    // the start of a block, something can branch in with anything in the registers
+    if ( instr->target )
+      live = 0xFFFF;
+  }
+
+  return changes;
+}
+
+
+// the optional peephole pass, run on the machine code before the branches are filled in.
+// instructions are decoded, improved until nothing changes, and put back together with the
+// labels and branches moved to where their instructions ended up
+// returns the new length of the code
+int optimize_code( unsigned char *machine_code, int length,
+                   vector<BranchPoint*> &labels,
+                   vector<BranchPoint*> &branches,
+                   vector<SourceLine> &lines )
+{
+  vector<Decoded> code( length / 2 );
+  vector<int> new_address( length / 2 + 1 );
+  int i;
+  int count = 0;
+  unsigned char *instr;
+
+  // a jump goes to an address in a register, which we can't move, so leave that code alone
+  for ( i=0 ; i<(int)code.size() ; i++ )
+  {
+    instr = &machine_code[i*2];
+    code[i].opcode = instr[0] >> 5;
+    code[i].mode = (instr[0] >> 2) & 0x07;
+    code[i].reg1 = ((instr[0] & 0x03) << 2) | (instr[1] >> 6);
+    code[i].reg2 = (instr[1] >> 2) & 0x0F;
+    code[i].literal = instr[1] & 0x3F;
+    if ( code[i].literal & 0x20 )
+      code[i].literal |= 0xC0;
+    code[i].target = false;
+    code[i].removed = false;
+
+    if ( code[i].opcode == BRANCH_OPCODE && code[i].mode == 0 )
+      return length;
+  }
+
+  for ( i=0 ; i<(int)labels.size() ; i++ )
+  {
+    if ( labels[i]->address / 2 < (int)code.size() )
+      code[labels[i]->address / 2].target = true;
+  }
+
+  while ( propagate_constants( code ) + remove_dead_writes( code ) > 0 )
+    ;
+
+  // squeeze out what was removed
+  for ( i=0 ; i<(int)code.size() ; i++ )
+  {
+    new_address[i] = count * 2;
+    if ( !code[i].removed )
+    {
+      encode_instruction( &code[i], &machine_code[count * 2] );
+      lines[count] = lines[i];
+      count++;
+    }
+  }
+  new_address[code.size()] = count * 2;
+  lines.resize( count );
+
+  // a label on a removed instruction now belongs to the next one
+  for ( i=0 ; i<(int)labels.size() ; i++ )
+    labels[i]->address = new_address[labels[i]->address / 2];
+  for ( i=0 ; i<(int)branches.size() ; i++ )
+    branches[i]->address = new_address[branches[i]->address / 2];
+
+  printf( "optimized %d instructions down to %d\n", (int)code.size(), count );
+
+  return count * 2;
+}
+
+
 // Takes each source line and converts it to the equivalent machine code.
 // If there is a branch, it does a second pass to find the jump points.
+// The optional peephole pass goes in between.
+// Fills in where each instruction came from.
 // Returns the number of bytes of actual machine code.
-int generate_machine_code( unsigned char *machine_code, vector<string> &source_text )
+int generate_machine_code( unsigned char *machine_code, vector<string> &source_text, bool optimize,
+                           vector<SourceLine> &lines )
 {
   int length = 0;
   int i;
@@ -322,10 +835,17 @@ int generate_machine_code( unsigned char *machine_code, vector<string> &source_t
   vector<BranchPoint*> labels;
   // a list of branch operations that we have to jump from
   vector<BranchPoint*> branches;
+  SourceLine source_line;
+  
+  strcpy( source_line.label, "-" );
   
   for ( i=0 ; i<(int)source_text.size() && length<CODE_SIZE ; i++ )
   {
     line = source_text[i].c_str();
+
+    // directives were dealt with before we got here
+    if ( is_directive( line ) )
+      continue;
     
     // try a labelled statement first
     labelled = true;
@@ -418,14 +938,22 @@ int generate_machine_code( unsigned char *machine_code, vector<string> &source_t
         the_label->label[strlen(the_label->label)-1] = '\0';
         
         labels.push_back( the_label );
+        strcpy( source_line.label, the_label->label );
       }
       
+      source_line.line = i + 1;
+      lines.push_back( source_line );
+      
       // put the instruction into our code space
       machine_code[length++] = instr_high;
       machine_code[length++] = instr_low;
     }
   }
   
+  // tidy up the code before the branch addresses are set in stone
+  if ( optimize )
+    length = optimize_code( machine_code, length, labels, branches, lines );
+
   // finally, put in the branch addresses
   fix_branches( machine_code, labels, branches );
   
@@ -446,6 +974,8 @@ int main (int argc, const char * argv[])
   string         line;           // used to read in a line of text
   unsigned char  machine_code[CODE_SIZE];
   int            byte_count = 0; // the number of bytes in the code
+  vector<SourceLine> lines;      // where each instruction came from
+  vector<Region> regions;        // the data the program wants in the scratchpad
   
   // since we're allowing anything to be specified, make sure it's a file that ends in .asm...
   if ( source_file.is_open() && strstr( argv[1], ".asm") != NULL )
@@ -457,12 +987,18 @@ int main (int argc, const char * argv[])
       source_text.push_back( line );
     }
     source_file.close();
+
+    // the directives have to make sense before there's any point going on
+    if ( !find_scratchpad( source_text, regions ) )
+      return 1;
     
     // process the file
-    byte_count = generate_machine_code( machine_code, source_text );
+    byte_count = generate_machine_code( machine_code, source_text, argc > 2 && strcmp( argv[2], "-O" ) == 0, lines );
     
-    // create the executable
+    // create the executable, and the line map for profiling it
     create_object_file( (char *)argv[1], machine_code, byte_count );
+    create_map_file( (char *)argv[1], lines );
+    create_scratchpad_file( (char *)argv[1], regions );
     
     // output the machine code version
     print_formatted_data( machine_code, byte_count );
@@ -10,11 +10,25 @@
 //-----------------------------------------
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <fstream>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <math.h>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 using namespace std;
 
@@ -23,7 +37,8 @@ using namespace std;
 
 // constants for our processor definition (sizes are in words)
 #define WORD_SIZE     2
-#define DATA_SIZE     1024
+#define DATA_SIZE     1024      // default data memory size, can be changed with -m
+#define MAX_DATA_SIZE 65536     // addresses are 16 bits so this is the most we can ever use
 #define CODE_SIZE     1024
 #define REGISTERS     16
 
@@ -37,18 +52,90 @@ using namespace std;
 #define BRANCH_LIMIT  1000000
 
 // CACHE_BLOCKS is the number of blocks in our cache directory and cache memory arrays(basically number of blocks in our cache)
+// this is the default, it can be changed with -b
 #define CACHE_BLOCKS 4
 
 // Block size is the number of words per block
+// this is the default, it can be changed with -s
 #define BLOCK_SIZE 2
 
-// the length of a cache block offset
-#define BLOCK_OFFSET		(int)log2(BLOCK_SIZE)
+// the biggest cache we'll let you ask for
+#define MAX_CACHE_BLOCKS 65536
 
-// since I restructured the data array to be a 3 Dimensional array, DATA_BLOCKS allows our data memory array
-// to store DATA_SIZE(1024) words
-// it is the number of blocks in our data memory array
-#define DATA_BLOCKS (DATA_SIZE/BLOCK_SIZE)
+// the most sectors a block can be split into, each has a bit in a mask
+#define MAX_SECTORS 32
+
+// the biggest victim cache we'll let you ask for, it's searched on every miss
+#define MAX_VICTIM_BLOCKS 64
+
+// data memory is split into pages that are only allocated the first time they are written.
+// a page must hold a whole number of blocks so a block never straddles two pages
+#define PAGE_WORDS    256
+#define DATA_PAGES    (MAX_DATA_SIZE/PAGE_WORDS)
+
+#if BLOCK_SIZE > PAGE_WORDS
+#error "BLOCK_SIZE can't be larger than PAGE_WORDS"
+#endif
+
+// virtual memory uses the same page size as data memory, so a physical frame is one data page
+#define PAGE_OFFSET   8         // log2(PAGE_WORDS)
+
+// the most cores we can simulate, each core starts with its number in R15
+#define MAX_CORES     16
+#define CORE_REGISTER 15
+
+// traces are read this many bytes at a time, a line of a text trace has to fit
+#define TRACE_BUFFER  65536
+
+// a binary trace record, a byte with the Dinero label followed by a 32-bit little endian byte address
+#define TRACE_RECORD  5
+
+// the largest access queue we'll let you ask for with --decouple
+#define MAX_DECOUPLE_RECORDS (1 << 24)
+
+// the most models --decouple-model can add, each runs on its own host thread
+#define MAX_DECOUPLE_MODELS 8
+
+// the default telemetry window, and how alike the instruction addresses two windows ran have to be
+// (the ones they share over the ones either ran) for them to be the same phase
+#define TELEMETRY_WINDOW 1000
+#define PHASE_SIMILARITY 0.5
+
+// the number of source lines the profiler lists as hot spots
+#define PROFILE_HOT_SPOTS 10
+
+// the layout advisor counts words as used together if they're this close in the reference stream
+#define LAYOUT_WINDOW 4
+
+// the largest TLB we'll simulate
+#define MAX_TLB_ENTRIES 1024
+
+// default cost of walking the page table on a TLB miss
+#define WALK_CYCLES   20
+
+// the DRAM behind the caches: the most banks, the default row size in words, the default latencies of a row
+// buffer hit, a miss on a closed bank and a conflict with another open row, and the cycles for each word of a burst
+#define MAX_DRAM_BANKS       64
+#define DRAM_ROW_WORDS       64
+#define DRAM_HIT_CYCLES      10
+#define DRAM_MISS_CYCLES     20
+#define DRAM_CONFLICT_CYCLES 30
+#define DRAM_WORD_CYCLES     1
+
+// the most words the scratchpad can hold, and what an access to it costs next to a cache hit
+#define MAX_SCRATCHPAD_WORDS 256
+#define SCRATCHPAD_CYCLES    1
+#define HIT_CYCLES           1
+
+// the most programs that can take turns on a core
+#define MAX_PROGRAMS  16
+
+// default time to fetch a block from main memory, and the most miss status holding registers we'll simulate
+#define MISS_CYCLES   20
+#define MAX_MSHRS     64
+
+// a register or word of data memory the static analysis doesn't know the value of
+#define UNKNOWN_VALUE -1
 
 // our opcodes are nicely incremental
 enum OPCODES
@@ -66,6 +153,16 @@ enum OPCODES
 
 typedef enum OPCODES Opcode;
 
+// the MOVE mode for a block move, MOVB [Rd],[Rs] copies R0 words from the address in Rs to the one in Rd.
+// it's one of the modes a MOVE can't otherwise have (memory to memory)
+#define BLOCK_MOVE_MODE 0x07
+
+// the mode bits for the packed arithmetic and logic instructions, which work on the two bytes of a word
+// side by side. the low bit still says whether the second operand is a register or a literal (which is
+// used for both bytes), and saturating adds and subtracts stop at 0 and 255 instead of wrapping around
+#define PACKED_MODE   0x02
+#define SATURATE_MODE 0x04
+
 // We have specific phases that we use to execute each instruction.
 // We use this to run through a simple state machine that always advances to the
 // next state and then cycles back to the beginning.
@@ -86,6 +183,37 @@ enum PHASES
 
 typedef enum PHASES Phase;
 
+// the ways we can pick a victim when a set is full
+enum REPLACEMENT_POLICIES
+{
+  LRU_POLICY,
+  FIFO_POLICY,
+  RANDOM_POLICY,
+  NUM_POLICIES
+};
+
+typedef enum REPLACEMENT_POLICIES Policy;
+
+// what the static analysis can say about a memory access
+enum VERDICTS
+{
+  ALWAYS_HIT,
+  ALWAYS_MISS,
+  UNKNOWN_ACCESS
+};
+
+typedef enum VERDICTS Verdict;
+
+// what to do with a run that's already in the result store
+enum RESULT_MODES
+{
+  USE_RESULTS,        // print it instead of running
+  VERIFY_RESULTS,     // run again and say if it matches
+  REFRESH_RESULTS     // run again and replace it
+};
+
+typedef enum RESULT_MODES ResultMode;
+
 // We use a structure to maintain our current state. This allows for the information
 // to be easily passed around.
 struct STATE
@@ -121,7 +249,12 @@ struct DIRECTORY
 	// since we are using write-back update policy
 	bool dirty;
 
-	// addresses are only 10 bits, so tag can always fit in a short
+	// set when other caches may hold a copy, so a write has to invalidate them first.
+	// with valid and dirty this gives the MESI state: invalid (!valid), modified (dirty),
+	// shared (shared) or exclusive (none of them)
+	bool shared;
+
+	// addresses are 16 bits, so tag can always fit in a short
 	unsigned short tag;
 
   // value that you use for tracking which entry in the directory is the least recently used.
@@ -129,6 +262,331 @@ struct DIRECTORY
 };
 
 
+// one translation cached in the TLB
+struct TLB_ENTRY
+{
+  bool valid;
+
+  // the virtual page and the physical frame it maps to
+  unsigned short page;
+  unsigned short frame;
+
+  // when the entry was last used (LRU) or loaded (FIFO)
+  unsigned long stamp;
+};
+
+
+// a TLB and what it has been up to
+struct TLB
+{
+  // grouped into sets of tlb_ways entries
+  struct TLB_ENTRY entries[MAX_TLB_ENTRIES];
+
+  int hits;
+  int misses;
+
+  // source of the LRU/FIFO stamps and the state of our random number generator
+  unsigned long counter;
+  unsigned long random;
+};
+
+
+// main memory's banks, the row each has open in its row buffer (-1 when it's closed) and what the accesses did
+struct DRAM
+{
+  int open_row[MAX_DRAM_BANKS];
+
+  unsigned long row_hits;        // the row was already open
+  unsigned long row_misses;      // the bank was closed, so the row only had to be opened
+  unsigned long row_conflicts;   // another row was open and had to be closed first
+  unsigned long fills;
+  unsigned long fill_cycles;
+  unsigned long writes;
+  unsigned long write_cycles;
+};
+
+
+// a recency list, the blocks of a cache from least to most recently used as a doubly linked list through
+// each block's newer and older neighbours (-1 at the ends), so finding and promoting a block are O(1)
+struct RECENCY
+{
+  vector<int> newer;
+  vector<int> older;
+  int oldest;
+  int newest;
+};
+
+
+// a private cache, everything needed to simulate it and keep it coherent with the others
+struct CACHE
+{
+  // the cache directory, one entry per block
+  vector<struct DIRECTORY> directory;
+
+  // the directory indexed by tag, for every block of main memory the cache block holding it or -1 if it
+  // isn't cached, so looking a block up doesn't have to scan the directory. valid_blocks counts the
+  // valid entries so a full cache doesn't have to be searched for an empty block either
+  vector<int> tag_index;
+  int valid_blocks;
+
+  // the blocks from least to most recently used (or filled, with FIFO), the block with the smallest
+  // reference count is always the oldest
+  struct RECENCY recency;
+
+  // the cache memory array, block_size words of WORD_SIZE bytes for each block
+  vector<unsigned char> memory;
+
+  // global counter variable to determine which cache block contains the least recently used entry
+  unsigned long lru_global_counter;
+
+  // the state of our random number generator for random replacement
+  unsigned long random;
+
+  // tracks cache hits and misses
+  int hits;
+  int misses;
+
+  // tracks coherence traffic
+  int invalidations;      // copies in other caches that our writes invalidated
+  int upgrades;           // writes to shared blocks that had to claim them first
+  int coherence_misses;   // misses on blocks another cache invalidated
+  int interventions;      // modified blocks written back because another cache asked for them
+
+  // the blocks of main memory another cache took away from us
+  vector<bool> lost;
+
+  // the victim cache, a small fully associative cache holding the blocks most recently thrown out
+  // of this one, laid out the same way as the directory and cache memory array
+  vector<struct DIRECTORY> victims;
+  vector<unsigned char> victim_memory;
+
+  // misses that found their block in the victim cache instead of going to main memory
+  int victim_hits;
+
+  // dirty blocks written back to main memory to make room
+  int writebacks;
+
+  // with sectors, a mask for each block of the sectors that are there and the ones that have changed.
+  // a miss on a block that's here without the sector we want only reads that sector (a sector miss)
+  vector<unsigned int> sector_valid;
+  vector<unsigned int> sector_dirty;
+  int sector_misses;
+
+  // the words that went between the cache and main memory
+  unsigned long words_read;
+  unsigned long words_written;
+
+  // the three C's. a miss on a block we've never used is compulsory. otherwise it's a capacity miss if a fully
+  // associative LRU cache of the same size (the shadow cache, which only keeps tags) would have missed too,
+  // and a conflict miss if it wouldn't have
+  int compulsory_misses;
+  int capacity_misses;
+  int conflict_misses;
+
+  // every block of main memory we've used, a byte each so it can be copied in one go
+  vector<unsigned char> seen;
+
+  // the shadow cache, its tags, the order they were used in and how many slots have been filled,
+  // and for every block of main memory its slot in the shadow cache or -1 if it isn't there
+  vector<unsigned short> shadow_tags;
+  struct RECENCY shadow_recency;
+  int shadow_used;
+  vector<int> shadow_slots;
+};
+
+
+// what the profiler counted for an instruction address
+struct PROFILE
+{
+  unsigned long executions;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long taken;       // times a branch was taken
+};
+
+// a memory access on its way from the interpreter to the cache with --decouple
+struct ACCESS
+{
+  unsigned short address;
+  unsigned short pc;       // the instruction that made it, for the profiler
+  bool           write;
+};
+
+// the queue of accesses between the interpreter and the cache models. only the interpreter moves head and
+// each model only moves its own tail, so none of them needs a lock, and a record is free again once every
+// model has gone past it
+struct RING
+{
+  vector<struct ACCESS> records;   // a power of 2 of them
+  size_t mask;
+  atomic<size_t> head;             // where the next access goes
+  atomic<size_t> tails[MAX_DECOUPLE_MODELS + 1];   // the next access for each cache model
+  int            models;           // how many tails are in use
+  atomic<bool>   finished;         // the interpreter has stopped
+};
+
+// a cache geometry and the cache routines for it, what a host thread needs to run a cache model
+struct GEOMETRY
+{
+  int blocks;
+  int words;
+  int offset;
+  unsigned short (*load)( struct CACHE *, unsigned short );
+  void (*store)( struct CACHE *, unsigned short, unsigned short );
+  bool (*find)( struct CACHE *, unsigned short, int & );
+};
+
+// a miss status holding register, a block on its way from main memory
+struct MSHR
+{
+  unsigned short tag;
+  unsigned long  ready;    // the cycle the block arrives
+};
+
+// the timing of a core with a non-blocking cache. an instruction issues a cycle after the one before, or when
+// the registers it reads are ready if that's later. a load's register is ready when its block arrives, so
+// the core carries on under a miss (hits and other misses included) until something needs the data
+struct TIMING
+{
+  unsigned long cycle;                  // when the next instruction can issue
+  unsigned long ready[REGISTERS];       // when each register's value is ready
+  vector<struct MSHR> mshrs;            // the misses in flight
+  unsigned long load_stalls;            // cycles waiting for a load's data
+  unsigned long mshr_stalls;            // cycles waiting for a free MSHR
+  unsigned long primary_misses;         // misses that took an MSHR
+  unsigned long merged_misses;          // accesses to a block already in flight
+  int peak;                             // the most MSHRs ever in use
+
+  // the cache counts when the current instruction started
+  int hits;
+  int misses;
+  int victim_hits;
+};
+
+// a run of telemetry windows that used much the same blocks
+struct PHASE
+{
+  int first_window;
+  int windows;
+  unsigned long instructions;
+  int hits;
+  int misses;
+};
+
+// the telemetry of a core, the counts when the current window started and the blocks it's used
+struct TELEMETRY
+{
+  int window;                    // the current window, from 0
+  unsigned long instructions;
+  int hits;
+  int misses;
+  int writebacks;
+  vector<int> used;              // the last window each block was used in, -1 if it never was
+  int working_set;               // the blocks used this window
+  vector<int> executed;          // the last window each instruction address was run in, -1 if it never was
+  int code_set;                  // the instruction addresses run this window
+  int previous_code;             // and last window
+  int common_code;               // the ones run in both
+  vector<struct PHASE> phases;
+};
+
+// a simulated core, with its own registers, state and private cache
+struct CORE
+{
+  int id;
+
+  // tracks what we're currently doing
+  State state;
+
+  // our general purpose registers
+  // NOTE: we let the registers match the host endianness so that the operations are easier -- all mapping occurs at the MDR
+  unsigned short registers[REGISTERS];
+
+  // where the core is in the control unit, or why it stopped
+  Phase phase;
+
+  // a count of branches so we can stop processing if we get an infinite loop
+  int branch_count;
+
+  // how many instructions the core has finished
+  unsigned long instructions;
+
+  struct CACHE cache;
+  struct TLB tlb;
+
+  // with profiling on, the counts for each instruction address, and the address and cache counts
+  // of the instruction being run
+  vector<struct PROFILE> profile;
+  unsigned short profile_pc;
+  int profile_hits;
+  int profile_misses;
+
+  struct TIMING timing;
+  struct TELEMETRY telemetry;
+
+  // accesses that went to the scratchpad instead of the cache
+  unsigned long scratchpad_accesses;
+};
+
+// a program taking turns with others on a core and its cache. while it's waiting its turn its code,
+// registers and state are kept here, and its data is in its own slice of data memory
+struct PROGRAM
+{
+  string code_file;
+  string data_file;
+  vector<unsigned char> code;
+  int base;                          // where its data memory starts
+
+  State state;
+  unsigned short registers[REGISTERS];
+  Phase phase;
+  int branch_count;
+  unsigned long instructions;
+
+  // the cache blocks it can use with partitioning, blocks is 0 without
+  int first_block;
+  int blocks;
+
+  int hits;
+  int misses;
+  int evicted;     // its blocks thrown out by the other programs
+  int evictions;   // the other programs' blocks it threw out
+};
+
+// what the static analysis knows when an instruction starts, whichever way the program got there
+struct ABSTRACT
+{
+  bool reached;                     // there's a way to get here at all
+  int  registers[REGISTERS];        // each register's value, or UNKNOWN_VALUE
+
+  // for a register we don't know the value of, the oldest the block it points at can be if it's been used
+  // for an access since it changed (so the block is cached), otherwise -1
+  int  block_ages[REGISTERS];
+
+  // the words the program has stored and their values, unless it's stored somewhere we don't know (clobbered)
+  // and we don't know any word. words that haven't been stored hold what the .dat put there
+  map<unsigned short, int> stored;
+  bool clobbered;
+
+  // the blocks that must be cached by the oldest they can be, and the ones that may be by the youngest.
+  // with may_any a block that isn't in may could be cached too
+  map<unsigned short, int> must;
+  map<unsigned short, int> may;
+  bool may_any;
+};
+
+// what the static analysis says about an instruction's accesses, each time it runs
+struct VERDICT
+{
+  int  accesses;
+  int  always_hits;
+  int  always_misses;
+  int  unknown;
+  int  block;          // the block of its only access, -1 if we don't know it or there's more than one
+  bool unresolved;     // it's a jump to an address we don't know
+};
+
+
 ////////////////////////////////////////////////////////////////////
 // prototypes
 Phase fetch_instr();
@@ -137,49 +595,231 @@ Phase calculate_ea();
 Phase fetch_operands();
 Phase execute_instr();
 Phase write_back();
-unsigned short load_data();
-void store_data(unsigned short );
-int read_block(unsigned short );
-void write_block(int );
-int lru_block();
-void cache_flush();
-void print_statistics();
-int get_empty_block();
-bool find_block( unsigned short, int &);
+void write_block( struct CACHE *, int );
+void cache_flush( struct CACHE * );
+void print_statistics( struct CACHE * );
+unsigned char *data_word( unsigned short, bool );
+unsigned char *cache_word( struct CACHE *, int, int );
+unsigned char *victim_word( struct CACHE *, int );
+bool map_address();
+void print_tlb_statistics( struct TLB * );
+void acquire_bus();
+void release_bus();
+void initialize_system();
+void save_settings();
+void restore_settings();
+void profile_instruction();
+void time_instruction();
+void use_block( unsigned short );
+void run_address( unsigned short );
+void check_window();
+void run_core( struct CORE * );
+void count_eviction( unsigned short );
+int partition_block( struct CACHE * );
+unsigned short scratchpad_load( struct CACHE *, unsigned short );
+void scratchpad_store( struct CACHE *, unsigned short, unsigned short );
+void run_instructions( unsigned long );
+void dram_access( unsigned short, int, bool );
+void print_stop_reason( struct CORE * );
+void initialize_core( struct CORE *, int );
 
 
 ////////////////////////////////////////////////////////////////////
 // local variables
 
-// a count of branches so we can stop processing if we get an infinite loop
-static int branch_count = 0;
-
-// tracks cache hits and misses
-static int hits;
-static int misses;
-
-// global counter variable to determine which cache block contains the least recently used entry
-static unsigned long lru_global_counter;
+// the cache geometry and replacement policy every core's cache uses. the geometry belongs to the host
+// thread, so each cache model a decoupled run drives can have its own. a new thread starts out with the
+// defaults, use_geometry() hands it its parent's
+static thread_local int cache_blocks = CACHE_BLOCKS;
+static thread_local int block_size = BLOCK_SIZE;
+static thread_local int block_offset;   // the length of a cache block offset, log2(block_size)
+static Policy cache_policy = LRU_POLICY;
+
+// the number of blocks in each cache's victim cache, 0 means there isn't one
+static int    victim_blocks = 0;
+
+// the number of sectors each block is split into, 0 means blocks aren't sectored
+static int    sectors = 0;
+static int    sector_words;           // block_size / sectors
+static int    sector_offset;          // log2(sector_words)
+
+// the cache routines for the host thread's geometry, see select_cache_model()
+static thread_local unsigned short (*load_data)( struct CACHE *, unsigned short );
+static thread_local void (*store_data)( struct CACHE *, unsigned short, unsigned short );
+static thread_local bool (*find_block)( struct CACHE *, unsigned short, int & );
+
+// the cores we're simulating, they all run the same code and share data memory
+static struct CORE cores[MAX_CORES];
+static int num_cores = 1;
+
+// the core the current host thread is simulating
+static thread_local struct CORE *core = cores;
+
+// with more than one core they either get their own host thread or take turns on this one,
+// quantum instructions at a time, which always interleaves them the same way. schedule_threads is the
+// schedule as it was given, threaded is turned off when there's only one core
+static bool threaded = true;
+static bool schedule_threads = true;
+static int  quantum = 1;
+
+// only one cache can use the bus (and main memory) at a time
+static mutex bus;
+
+// sampled simulation, every sample_interval instructions we run sample_warmup instructions in detail to warm
+// the cache up and then measure the next sample_window. everything else runs in the fast functional mode.
+// an interval of 0 means everything is simulated in detail
+static int sample_interval = 0;
+static int sample_warmup = 0;
+static int sample_window = 0;
+
+// set while we're fast forwarding, memory accesses skip the cache (and TLB) entirely
+static bool functional = false;
+
+// with decoupling the interpreter reads and writes main memory directly and queues each access for the
+// cache, which runs on its own host thread with only the tags, so it never touches main memory.
+// decouple_records is the size of the queue, 0 means the cache runs inline as usual
+static int  decouple_records = 0;
+static bool decoupled = false;
+static struct RING ring;
+static size_t ring_tail;   // the interpreter's last look at the oldest tail, so it doesn't have to keep asking
+
+// the models --decouple-model adds, each with a core of its own to hold its cache. they follow the
+// same accesses as the configured cache, each on its own host thread, and are reported after it
+static vector<struct GEOMETRY> decouple_models;
+static struct CORE model_cores[MAX_DECOUPLE_MODELS];
+
+// the cache routines the scratchpad passes the rest of the accesses on to
+static unsigned short (*model_load)( struct CACHE *, unsigned short );
+static void (*model_store)( struct CACHE *, unsigned short, unsigned short );
+
+// what we measured in each sample window
+static vector<int> window_hits;
+static vector<int> window_misses;
+
+// memory accesses made in the functional mode, which we didn't simulate
+static unsigned long skipped_accesses;
 
 // memory for our code, using our word size for a second dimension to make accessing bytes easier
 static unsigned char code[CODE_SIZE][WORD_SIZE];
 
-// restructured data array to have the same structure as our cache memory
-// allows for easy reading and writing from/to this data memory array
-static unsigned char data[DATA_BLOCKS][BLOCK_SIZE][WORD_SIZE]; 
-
-// the cache directory
-static struct DIRECTORY cache_directory[CACHE_BLOCKS];
-
-// the cache memory array
-static unsigned char cache_memory[CACHE_BLOCKS][BLOCK_SIZE][WORD_SIZE];
-
-// our general purpose registers
-// NOTE: we let the registers match the host endianness so that the operations are easier -- all mapping occurs at the MDR
-static unsigned short registers[REGISTERS];
+// data memory is a page table, each entry is NULL until that page is first written
+// a page is PAGE_WORDS words of WORD_SIZE bytes, stored big endian like the cache
+static unsigned char *data[DATA_PAGES];
+
+// every page we've allocated, so resetting only costs as much as the pages that were used
+static vector<int> touched_pages;
+
+// what untouched pages read as
+static unsigned char filler_page[PAGE_WORDS*WORD_SIZE];
+
+// the number of words of data memory the program is allowed to use
+static int data_size = DATA_SIZE;
+
+// the simulated page table, the frame each virtual page maps to or -1 if it isn't mapped yet
+// frames are handed out in the order pages are first touched
+static int page_table[DATA_PAGES];
+static int next_frame;
+
+// virtual memory settings, a TLB with no entries means virtual memory is off
+static int    tlb_entries = 0;
+static int    tlb_ways = 0;          // 0 means fully associative
+static Policy tlb_policy = LRU_POLICY;
+static int    walk_cycles = WALK_CYCLES;
+
+// telemetry is written to telemetry_file a line per window of telemetry_window instructions, or accesses
+static const char *telemetry_file = NULL;
+static FILE       *telemetry = NULL;
+static int         telemetry_window = TELEMETRY_WINDOW;
+static bool        window_by_accesses = false;
+
+// the non-blocking cache timing, no MSHRs means we don't time anything
+static int    mshr_count = 0;
+static int    miss_cycles = MISS_CYCLES;
+
+// the DRAM model, no banks means main memory costs nothing beyond --miss-cycles. rows are dram_row words and
+// the banks are interleaved by row unless dram_block_map says by block
+static int         dram_banks = 0;
+static int         dram_row = DRAM_ROW_WORDS;
+static bool        dram_closed_page = false;
+static bool        dram_block_map = false;
+static int         dram_hit = DRAM_HIT_CYCLES;
+static int         dram_miss = DRAM_MISS_CYCLES;
+static int         dram_conflict = DRAM_CONFLICT_CYCLES;
+static struct DRAM dram;
+
+// pages the page table has had to map
+static int page_faults;
+
+// checkpointing, once every core has run checkpoint_at instructions the machine is saved to checkpoint_file.
+// restore_file starts the run from a checkpoint instead of the code and data files, and fork_file
+// restores one checkpoint into a run for each line of options in it
+static unsigned long checkpoint_at = 0;
+static const char   *checkpoint_file = NULL;
+static const char   *restore_file = NULL;
+static const char   *fork_file = NULL;
+
+// a trace of memory references to run through the cache instead of a program ("-" reads stdin),
+// either Dinero text lines or packed binary records
+static const char *trace_file = NULL;
+static bool        trace_binary = false;
+
+// what the trace held, references we couldn't run through the data cache aren't counted as reads or writes
+static unsigned long trace_reads;
+static unsigned long trace_writes;
+static unsigned long trace_ignored;   // instruction fetches and anything else that isn't a data reference
+static unsigned long trace_outside;   // data references outside data memory
+
+// the layout advisor records every data address the program uses to layout_prefix.dat and .map.
+// remap holds a layout read from a map file, the address each of the program's addresses moved to,
+// and is empty when the data is where the program thinks it is
+static const char            *layout_prefix = NULL;
+static const char            *remap_file = NULL;
+static vector<unsigned short> layout_references;
+static vector<unsigned short> remap;
+
+// the source file to profile, its line map is the file with the same name ending in .lines
+static const char            *profile_source = NULL;
+
+// more programs to take turns with the one on the command line, quantum instructions at a time, sharing the
+// core's cache. empty if there's only the one. each gets data_size words of data memory, in a slice of
+// program_words that starts on a block boundary so no block holds two programs' words, and with partitioning
+// its own share of the cache blocks, equal shares or a comma separated list of them
+static vector<struct PROGRAM> programs;
+static int         program_words;
+static int         current_program;
+static int         program_switches;
+static const char *partition_spec = NULL;
+
+// the scratchpad, the words of data memory listed in scratchpad_file are kept in it instead of going through
+// the cache. in_scratchpad says which for every word of data memory and scratchpad has WORD_SIZE bytes for
+// each of them too, though only the scratchpad's are used. no words means there isn't one
+static const char           *scratchpad_file = NULL;
+static int                   scratchpad_words = 0;
+static int                   scratchpad_regions = 0;
+static vector<bool>          in_scratchpad;
+static vector<unsigned char> scratchpad;
+
+// the directory runs are stored in with --results, NULL if they aren't, and what to do with one that's there
+static const char *results_path = NULL;
+static ResultMode  results_mode = USE_RESULTS;
+
+// analyze the program instead of running it, for the data in the .dat or for any data at all
+static bool analyze = false;
+static bool analyze_any = false;
+
+// the server takes jobs from a Unix socket at this path, or - for stdin
+static const char *serve_path = NULL;
+
+// code and data files as they were read, so a server doesn't read the same files again for every job.
+// a file is read again if its modification time (to the nanosecond) or size has changed since
+struct IMAGE
+{
+  struct timespec modified;
+  off_t           size;
+  string          contents;
+};
 
-// tracks what we're currently doing
-static State state;
+static map<string, struct IMAGE> images;
 
 // A list of handlers to process each state. Provides for a nice simple
 // state machine loop and is easily extended without using a huge
@@ -193,13 +833,19 @@ static process_phase control_unit[NUM_PHASES] =
 //////////////////////////////////////////////////////////////////////////
 // data extraction support routines
 
-#define opcode() ((Opcode)(state.IR[0] >> 5))
-#define mode()   ((state.IR[0] >> 2) & 0x07)
+// the number of bits needed for an offset into n words, worked out by the compiler when n is a constant
+constexpr int log2_of( int n )
+{
+  return n <= 1 ? 0 : 1 + log2_of( n/2 );
+}
+
+#define opcode() ((Opcode)(core->state.IR[0] >> 5))
+#define mode()   ((core->state.IR[0] >> 2) & 0x07)
 
 // pulls a literal value from the 2nd operand of the current instruction
 char extract_literal()
 {
-  char value = (state.IR[1] & 0x3F);
+  char value = (core->state.IR[1] & 0x3F);
   
   // sign extend if negative
   if ( value & 0x20 )
@@ -209,10 +855,52 @@ char extract_literal()
 }
 
 
+// whether an arithmetic or logic instruction can have the passed mode, 000b and 001b for a word,
+// packed 01xb for all of them and packed saturating 11xb only for adds and subtracts
+bool alu_mode( int opcode, int mode )
+{
+  if ( mode & SATURATE_MODE )
+    return (mode & PACKED_MODE) && opcode <= SUB_OPCODE;
+
+  return true;
+}
+
+
+// works out a packed instruction a byte at a time, with no carries or borrows between the bytes
+unsigned short packed_alu( int opcode, bool saturate, unsigned short x, unsigned short y )
+{
+  unsigned short z = 0;
+  int shift;
+  int a;
+  int b;
+  int c;
+
+  for ( shift=0 ; shift<16 ; shift+=8 )
+  {
+    a = (x >> shift) & 0xFF;
+    b = (y >> shift) & 0xFF;
+    switch( opcode )
+    {
+      case ADD_OPCODE:  c = a + b;  break;
+      case SUB_OPCODE:  c = a - b;  break;
+      case AND_OPCODE:  c = a & b;  break;
+      case OR_OPCODE:   c = a | b;  break;
+      default:          c = a ^ b;  break;
+    }
+
+    if ( saturate )
+      c = max( 0, min( 0xFF, c ) );
+    z |= (c & 0xFF) << shift;
+  }
+
+  return z;
+}
+
+
 static unsigned char get_reg1()
 {
   unsigned char reg1 = 0xFF;
-  reg1 = ((state.IR[0]&0x03)<<2) | (state.IR[1]>>6);
+  reg1 = ((core->state.IR[0]&0x03)<<2) | (core->state.IR[1]>>6);
   reg1 &= 0x0F;
   
   return reg1;  
@@ -228,17 +916,40 @@ Phase fetch_instr()
   Phase rc = DECODE_INSTR;
   
   // make sure it's in range
-  if ( state.PC < CODE_SIZE )
+  if ( core->state.PC < CODE_SIZE )
   {
     // using the MAR/MDR seems really weird here since you can just use the PC to index code[]
     // but, we should do it the way the CPU would handle things.
-    state.MAR = state.PC;
-    state.MDR = code[state.MAR][0];
-    state.MDR <<= 8;
-    state.MDR |= code[state.MAR][1];
+    core->state.MAR = core->state.PC;
+    core->state.MDR = code[core->state.MAR][0];
+    core->state.MDR <<= 8;
+    core->state.MDR |= code[core->state.MAR][1];
     
-    state.IR[0] = (unsigned char)(state.MDR >> 8);
-    state.IR[1] = (unsigned char)(state.MDR & 0x00ff);
+    core->state.IR[0] = (unsigned char)(core->state.MDR >> 8);
+    core->state.IR[1] = (unsigned char)(core->state.MDR & 0x00ff);
+
+    if ( telemetry != NULL )
+      run_address( core->state.PC );
+
+    // so does the timing
+    if ( mshr_count > 0 )
+    {
+      core->timing.hits = core->cache.hits;
+      core->timing.misses = core->cache.misses;
+      core->timing.victim_hits = core->cache.victim_hits;
+    }
+
+    // the profiler counts what happens from here until the instruction is written back.
+    // a decoupled cache counts its own hits and misses
+    if ( !core->profile.empty() )
+    {
+      core->profile_pc = core->state.PC;
+      if ( !decoupled )
+      {
+        core->profile_hits = core->cache.hits;
+        core->profile_misses = core->cache.misses;
+      }
+    }
   }
   else
     rc = ILLEGAL_ADDRESS;
@@ -256,20 +967,25 @@ Phase decode_instr()
   // validate the instruction before continuing
   switch( opcode() )
   {
-      // valid modes are 000b and 001b
+      // valid modes are 000b and 001b, and the packed ones
     case ADD_OPCODE:
     case SUB_OPCODE:
     case AND_OPCODE:
     case OR_OPCODE:
     case XOR_OPCODE:
+      if ( !alu_mode( opcode(), mode() ) )
+        rc = ILLEGAL_OPCODE;
+      break;
+
+      // valid modes are 000b and 001b
     case SHIFT_OPCODE:
       if ( mode() > 1 )
         rc = ILLEGAL_OPCODE;
       break;
       
-      // invalid mode if the second bit is set
+      // invalid mode if the second bit is set, except for a block move
     case MOVE_OPCODE:
-      if ( mode() & 0x02 )
+      if ( (mode() & 0x02) && mode() != BLOCK_MOVE_MODE )
         rc = ILLEGAL_OPCODE;
       else
         rc = CALCULATE_EA;
@@ -305,14 +1021,14 @@ Phase calculate_ea()
   // the second operand has our memory address
   else if ( mode() & 0x01 )
   {
-    reg = state.IR[1] >> 2;
+    reg = core->state.IR[1] >> 2;
     reg &= 0x0F;
   }
   
   // load the address if we have a valid register
   if ( reg != 0xFF )
   {
-    state.MAR = registers[reg];
+    core->state.MAR = core->registers[reg];
   }
   
   return rc;
@@ -330,26 +1046,29 @@ Phase fetch_operands()
   if ( opcode() != MOVE_OPCODE )
   {
     reg = get_reg1();
-    state.ALU_x = registers[reg];
+    core->state.ALU_x = core->registers[reg];
   }
   
   // operand 2 is more complicated...
   
   // calculate a register value in case we need it
-  reg = state.IR[1] >> 2;
+  reg = core->state.IR[1] >> 2;
   reg &= 0x0F;
   switch( opcode() )
   {
-      // depending on the mode, put register contents or the literal into the "register"
+      // depending on the mode, put register contents or the literal into the "register".
+      // a packed instruction uses the literal for both bytes
     case ADD_OPCODE:
     case SUB_OPCODE:
     case AND_OPCODE:
     case OR_OPCODE:
     case XOR_OPCODE:
-      if ( mode() == 0 )
-        state.ALU_y = extract_literal();
+      if ( (mode() & 0x01) == 0 && (mode() & PACKED_MODE) )
+        core->state.ALU_y = (unsigned char)extract_literal() * 0x0101;
+      else if ( (mode() & 0x01) == 0 )
+        core->state.ALU_y = extract_literal();
       else
-        state.ALU_y = registers[reg];
+        core->state.ALU_y = core->registers[reg];
       break;
       
       // to simplify things we always put the data into the MDR, even for a literal to
@@ -361,32 +1080,34 @@ Phase fetch_operands()
       rc = WRITE_BACK;
       
       // copy in the literal or register contents
+      // (for a block move that's the source address, the MAR has the destination)
       if ( (mode() & 0x01) == 0 )
-        state.MDR = extract_literal();
+        core->state.MDR = extract_literal();
       else if ( mode() & 0x04 )
       {
-        state.MDR = registers[reg];
+        core->state.MDR = core->registers[reg];
       }
       
       // otherwise, fetch from memory
       else
       {
-        // this is a check to make sure that the tag extracted from the MAR does not exceed the number of blocks in main memory
-          // otherwise it is an illegal address
-        if ( (state.MAR >> BLOCK_OFFSET) < DATA_BLOCKS )
+        // make sure the MAR is inside the configured data memory, otherwise it is an illegal address
+        acquire_bus();
+        if ( map_address() )
         {
-          state.MDR = load_data();
+          core->state.MDR = load_data( &core->cache, core->state.MAR );
         }
         else
         {
           rc = ILLEGAL_ADDRESS;
         }
+        release_bus();
       }
       break;
       
       // branches always have a literal, ignored for jumps...  
     case BRANCH_OPCODE:
-      state.ALU_y = extract_literal();
+      core->state.ALU_y = extract_literal();
       break;
       
     default:
@@ -402,44 +1123,51 @@ Phase execute_instr()
 {
   Phase rc = WRITE_BACK;
   
+  // the packed instructions have their own ALU
+  if ( opcode() <= XOR_OPCODE && (mode() & PACKED_MODE) )
+  {
+    core->state.ALU_z = packed_alu( opcode(), mode() & SATURATE_MODE, core->state.ALU_x, core->state.ALU_y );
+    return rc;
+  }
+
   switch( opcode() )
   {
     case ADD_OPCODE:
-      state.ALU_z = (short)state.ALU_x + (short)state.ALU_y;
+      core->state.ALU_z = (short)core->state.ALU_x + (short)core->state.ALU_y;
       break;
       
     case SUB_OPCODE:
-      state.ALU_z = (short)state.ALU_x - (short)state.ALU_y;
+      core->state.ALU_z = (short)core->state.ALU_x - (short)core->state.ALU_y;
       break;
       
     case AND_OPCODE:
-      state.ALU_z = state.ALU_x & state.ALU_y;
+      core->state.ALU_z = core->state.ALU_x & core->state.ALU_y;
       break;
       
     case OR_OPCODE:
-      state.ALU_z = state.ALU_x | state.ALU_y;
+      core->state.ALU_z = core->state.ALU_x | core->state.ALU_y;
       break;
       
     case XOR_OPCODE:
-      state.ALU_z = state.ALU_x ^ state.ALU_y;
+      core->state.ALU_z = core->state.ALU_x ^ core->state.ALU_y;
       break;
       
     case SHIFT_OPCODE:
       if ( mode() == 0 )
-        state.ALU_z = state.ALU_x >> 1;
+        core->state.ALU_z = core->state.ALU_x >> 1;
       else
-        state.ALU_z = state.ALU_x << 1;
+        core->state.ALU_z = core->state.ALU_x << 1;
       break;
       
     case BRANCH_OPCODE:
       // handle the jump separately since it's special
       if ( mode() == 0 )
       {
-        state.ALU_z = state.ALU_x;
+        core->state.ALU_z = core->state.ALU_x;
         
         // check for infinite loops
-        branch_count++;
-        if (branch_count > BRANCH_LIMIT )
+        core->branch_count++;
+        if (core->branch_count > BRANCH_LIMIT )
           rc = INFINITE_LOOP;
       }
       
@@ -451,37 +1179,37 @@ Phase execute_instr()
         {
             // BEQ
           case 1:
-            if ( (short)state.ALU_x == (short)registers[0] )
+            if ( (short)core->state.ALU_x == (short)core->registers[0] )
               branch = true;
             break;
             
             // BNE
           case 2:
-            if ( (short)state.ALU_x != (short)registers[0] )
+            if ( (short)core->state.ALU_x != (short)core->registers[0] )
               branch = true;
             break;
             
             // BLT
           case 3:
-            if ( (short)state.ALU_x < (short)registers[0] )
+            if ( (short)core->state.ALU_x < (short)core->registers[0] )
               branch = true;
             break;
             
             // BGT
           case 4:
-            if ( (short)state.ALU_x > (short)registers[0] )
+            if ( (short)core->state.ALU_x > (short)core->registers[0] )
               branch = true;
             break;
             
             // BLE
           case 5:
-            if ( (short)state.ALU_x <= (short)registers[0] )
+            if ( (short)core->state.ALU_x <= (short)core->registers[0] )
               branch = true;
             break;
             
             // BGE
           case 6:
-            if ( (short)state.ALU_x >= (short)registers[0] )
+            if ( (short)core->state.ALU_x >= (short)core->registers[0] )
               branch = true;
             break;
         }
@@ -489,17 +1217,17 @@ Phase execute_instr()
         // we always update the PC, but it only changes if required
         if ( branch )
         {
-          state.ALU_z = state.PC + state.ALU_y - 1;
+          core->state.ALU_z = core->state.PC + core->state.ALU_y - 1;
           
           // check for infinite loops
-          branch_count++;
-          if (branch_count > BRANCH_LIMIT )
+          core->branch_count++;
+          if (core->branch_count > BRANCH_LIMIT )
             rc = INFINITE_LOOP;
         }
         
         else
           // still need the PC in ALU_z for write back...
-          state.ALU_z = state.PC;
+          core->state.ALU_z = core->state.PC;
       }
       break;
       
@@ -511,6 +1239,104 @@ Phase execute_instr()
 }
 
 
+// returns the word at the passed address of a block we've just accessed, without counting it as another
+// access. while fast forwarding there's no cache so it's the word in main memory
+unsigned char *block_word( unsigned short address, bool write )
+{
+  unsigned char *word;
+  int block_index;
+
+  if ( functional || decoupled )
+    word = data_word( address, write );
+  else if ( scratchpad_words > 0 && in_scratchpad[address] )
+    word = &scratchpad[address*WORD_SIZE];
+  else
+  {
+    find_block( &core->cache, address >> block_offset, block_index );
+    word = cache_word( &core->cache, block_index, address & (block_size - 1) );
+  }
+
+  return word;
+}
+
+
+// carries out a block move, copying R0 words from the address in the MDR to the address in the MAR.
+// the words are copied a piece at a time, where a piece is as much as fits in both the source's and the
+// destination's cache block. the cache (and TLB) see each piece as a single load and a single store, the
+// rest of its words are copied straight from one block to the other
+Phase move_block()
+{
+  Phase rc = FETCH_INSTR;
+  unsigned short source = core->state.MDR;
+  unsigned short destination = core->state.MAR;
+  int count = core->registers[0];
+  int piece;
+  int i;
+  unsigned short words[PAGE_WORDS];  // a piece is never more than a block
+  unsigned char *word;
+  int limit = tlb_entries > 0 ? MAX_DATA_SIZE : data_size;
+
+  // only the first word of each piece is mapped, so the whole move has to fit before anything is copied
+  if ( source + count > limit || destination + count > limit )
+    return ILLEGAL_ADDRESS;
+
+  while ( count > 0 && rc == FETCH_INSTR )
+  {
+    piece = min( block_size - (source & (block_size - 1)), block_size - (destination & (block_size - 1)) );
+    piece = min( piece, count );
+
+    // with sectors the rest of the block may not be there
+    if ( sectors > 0 )
+      piece = min( piece, min( sector_words - (source & (sector_words - 1)), sector_words - (destination & (sector_words - 1)) ) );
+
+    // with the data laid out differently neighbouring words aren't neighbours any more,
+    // and a word in the scratchpad has no block for its neighbours to be in
+    if ( !remap.empty() || (scratchpad_words > 0 && (in_scratchpad[source] || in_scratchpad[destination])) )
+      piece = 1;
+
+    // a block never straddles a page, so if the first word of a piece maps so does the rest
+    acquire_bus();
+    core->state.MAR = source;
+    if ( map_address() )
+    {
+      words[0] = load_data( &core->cache, core->state.MAR );
+      for ( i=1 ; i<piece ; i++ )
+      {
+        word = block_word( core->state.MAR + i, false );
+        words[i] = (word[0] << 8) | word[1];
+        if ( layout_prefix != NULL )
+          layout_references.push_back( source + i );
+      }
+
+      core->state.MAR = destination;
+      if ( map_address() )
+      {
+        store_data( &core->cache, core->state.MAR, words[0] );
+        for ( i=1 ; i<piece ; i++ )
+        {
+          word = block_word( core->state.MAR + i, true );
+          word[0] = words[i] >> 8;
+          word[1] = words[i] & 0x00FF;
+          if ( layout_prefix != NULL )
+            layout_references.push_back( destination + i );
+        }
+      }
+      else
+        rc = ILLEGAL_ADDRESS;
+    }
+    else
+      rc = ILLEGAL_ADDRESS;
+    release_bus();
+
+    source += piece;
+    destination += piece;
+    count -= piece;
+  }
+
+  return rc;
+}
+
+
 // we will either write to a register, the PC or memory
 Phase write_back()
 {
@@ -527,34 +1353,39 @@ Phase write_back()
     case OR_OPCODE:
     case XOR_OPCODE:
     case SHIFT_OPCODE:
-      registers[reg] = state.ALU_z;
+      core->registers[reg] = core->state.ALU_z;
       break;
       
       // update the PC, if no branch it will simply re-write itself  
     case BRANCH_OPCODE:
-      state.PC = state.ALU_z;
+      core->state.PC = core->state.ALU_z;
       break;
       
     case MOVE_OPCODE:
+      // a block move does its own loads and stores
+      if ( mode() == BLOCK_MOVE_MODE )
+        rc = move_block();
+
       // do we put the contents of MDR into a register or memory?
-      if ( mode() & 0x04 )
+      else if ( mode() & 0x04 )
       {
         // memory
 
-        // this is a check to make sure that the tag extracted from the MAR does not exceed the number of blocks in main memory
-          // otherwise, it is an illegal address
-        if ( (state.MAR >> BLOCK_OFFSET) < DATA_BLOCKS )
+        // make sure the MAR is inside the configured data memory, otherwise, it is an illegal address
+        acquire_bus();
+        if ( map_address() )
         {
-          store_data(state.MDR);
+          store_data( &core->cache, core->state.MAR, core->state.MDR );
         } else 
         {
           rc = ILLEGAL_ADDRESS;
         }
+        release_bus();
       }
       
       else
         // register
-        registers[reg] = state.MDR;
+        core->registers[reg] = core->state.MDR;
       
       break;
       
@@ -562,521 +1393,5533 @@ Phase write_back()
       break;
   }
   
+  if ( !core->profile.empty() )
+    profile_instruction();
+  if ( mshr_count > 0 && rc == FETCH_INSTR )
+    time_instruction();
+
   // don't forget to increment the program counter
-  state.PC++;
+  core->state.PC++;
+  core->instructions++;
+
+  if ( telemetry != NULL )
+    check_window();
   
   return rc;
 }
 
 
-// This function copies a specified block in the cache to the appropriate location in main memory
-void write_block(int ca_index)
+// returns a pointer to the first byte of the word at the passed address in data memory.
+// pages are allocated on the first write to them, until then reads are served from the filler page
+// (which must never be written through the returned pointer).
+unsigned char *data_word( unsigned short address, bool write )
 {
-  unsigned short address; // an address in main memory
-  int i; // loop counter variable
-
-  address = cache_directory[ca_index].tag;  // Specifies the block we should be writing to in main memory
+  int page = address / PAGE_WORDS;
+  unsigned char *base = data[page];
 
-  // make sure the cache block is valid
-  // that is make sure this cache block contains a real cache entry that has been explicitly loaded from main memory
-  if ( cache_directory[ca_index].valid ) {
-    // writes a specified block in the cache to the appropriate location in main memory(the 3D data array)
-    for( i=0 ; i<BLOCK_SIZE ; i++ )
+  if ( base == NULL )
+  {
+    if ( write )
     {
-      data[address][i][0] = cache_memory[ca_index][i][0];
-      data[address][i][1] = cache_memory[ca_index][i][1];
+      base = new unsigned char[PAGE_WORDS*WORD_SIZE];
+      memset( base, MEM_FILLER, PAGE_WORDS*WORD_SIZE );
+      data[page] = base;
+      touched_pages.push_back( page );
     }
+    else
+      base = filler_page;
   }
+
+  return base + (address % PAGE_WORDS)*WORD_SIZE;
 }
 
 
-// this function returns the index of the first empty block in the cache
-// tf there are no empty blocks, this function returns -1
-int get_empty_block() {
-  bool found = false; // for loop stop condition
-  int empty_block_index = -1; // initially set to -1 to indicate that there are no empty blocks
+// returns the first byte of the passed word of a block in the cache
+unsigned char *cache_word( struct CACHE *cache, int block_index, int offset )
+{
+  return &cache->memory[(block_index*block_size + offset)*WORD_SIZE];
+}
 
-  // loop through the cache directory,
-  // if an empty cache block is found (valid bit is not set i.e valid = false),
-  // exit the loop immediately and return the index of that empty cache block
-  // if an empty cache block is not found, return -1
-  for ( int i = 0; i < CACHE_BLOCKS && !found; i++ ) {
-      if ( !(cache_directory[i].valid) ) {
-          empty_block_index = i;
-          found = true;
-      }
+
+// adds a cache block to the tag index, call it whenever a directory entry becomes valid or changes tag
+void index_block( struct CACHE *cache, int block_index )
+{
+  if ( cache->directory[block_index].valid )
+  {
+    cache->tag_index[cache->directory[block_index].tag] = block_index;
+    cache->valid_blocks++;
   }
-    return empty_block_index;
 }
 
 
-// finds the cache block containing the least recently used
-// entry in the cache directory and returns the cache block index
-// similar to the implementation of a getMin() function
-int lru_block() {
-  int lru_block = cache_directory[0].reference_count;  // assume the first block in the cache directory contains the least recently used entry
-  int lru_block_index = 0;  // index of the cache block containing the least recently used entry
-
-  // start looping through all cache blocks from the second cache block, assuming CACHE_BLOCKS > 1
-  for ( int i = 1; i < CACHE_BLOCKS; i++ ) {
-    // if we find a cache block with the least recently used entry, assign the index of that cache block to our lru_block_index variable
-    if ( cache_directory[i].reference_count < lru_block ) { 
-      lru_block = cache_directory[i].reference_count;
-      lru_block_index = i;
-    }
+// takes a cache block out of the tag index, call it before a directory entry is invalidated or replaced
+void unindex_block( struct CACHE *cache, int block_index )
+{
+  if ( cache->directory[block_index].valid )
+  {
+    cache->tag_index[cache->directory[block_index].tag] = -1;
+    cache->valid_blocks--;
   }
-  return lru_block_index;
 }
 
 
-// loads a block from main memory into the cache
-// first checks to load an empty block in the cache
-// if it does not find an empty block, it finds the least recently used block and loads data into it
-// returns the index of cache block that the block from main memory was loaded into 
-int read_block(unsigned short address)
+// makes a block the most recently used by moving it to the newest end of a recency list
+void promote( struct RECENCY *recency, int block_index )
 {
-  int i;   // loop counter variable
-  int cache_index; // the cache index of the empty cache block or the cache block containing the least recently used entry
-  unsigned short memory_address; // address in main memory
+  int newer = recency->newer[block_index];
+  int older = recency->older[block_index];
 
-  // extracts the tag from the passed address
-  memory_address = address;
-  memory_address >>= BLOCK_OFFSET;
-
-  // first checks to see if there is an empty cache block
-  // recall from find_empty_block(), that it returns -1 if there are no empty cache blocks
-  // if there is an empty cache block, assign the index of the empty cache block to cache_index
-  // if there is not an empty cache block, then it gets the index of the cache block containing the least recently used entry
-  if ( get_empty_block() > -1 ) {
-    cache_index = get_empty_block();
-  } else {
-    cache_index = lru_block();  
-  }
-    
-  // using write-back update policy
-  // if the cache block is dirty, write that block to main memory
-  // then set the dirty bit to 0(that is dirty = false)
-  if( cache_directory[cache_index].dirty )
+  if ( block_index != recency->newest )
   {
-    write_block(cache_index);
-    cache_directory[cache_index].dirty = false;
+    // unlink it, it has a newer neighbour since it isn't the newest
+    recency->older[newer] = older;
+    if ( older >= 0 )
+      recency->newer[older] = newer;
+    else
+      recency->oldest = newer;
+
+    // and put it on the end
+    recency->older[block_index] = recency->newest;
+    recency->newer[block_index] = -1;
+    recency->newer[recency->newest] = block_index;
+    recency->newest = block_index;
   }
+}
 
-  // takes the cache index of the empty cache block 
-  // or the cache index of the cache block containing the least recently used entry
-  // make that cache block, the most recently used
-  lru_global_counter = lru_global_counter + 1;
-  cache_directory[cache_index].reference_count = lru_global_counter;
 
-  // copies a block from main memory and stores it in the appropriate cache block
-  for( i=0 ; i<BLOCK_SIZE; i++ )
+// puts a recency list for the passed number of blocks in block order
+void initialize_recency( struct RECENCY *recency, int blocks )
+{
+  int i;
+
+  recency->newer.resize( blocks );
+  recency->older.resize( blocks );
+  for ( i=0 ; i<blocks ; i++ )
   {
-    cache_memory[cache_index][i][0] = data[memory_address][i][0];
-    cache_memory[cache_index][i][1] = data[memory_address][i][1];
+    recency->newer[i] = i+1 < blocks ? i+1 : -1;
+    recency->older[i] = i-1;
   }
-
-  // The cache block is now valid since we have explicitly loaded data from main memory array into it 
-  cache_directory[cache_index].valid = true; 
-  cache_directory[cache_index].tag = memory_address;
-  return cache_index;
+  recency->oldest = 0;
+  recency->newest = blocks - 1;
 }
 
 
-// looks for the cache block in the cache directory with the same tag as the passed tag 
-// returns true if found, false otherwise
-// if found, sets block_index variable, so we can identify the cache block
-bool find_block( unsigned short tag, int &block_index )
+// This function copies a specified block in the cache to the appropriate location in main memory
+void write_block( struct CACHE *cache, int ca_index )
 {
-  bool found = false; // for loop stop condition
-  int i;
+  unsigned char *block; // the first byte of the block in main memory
+  unsigned char *cached; // the first byte of the block in the cache
 
-  for ( i=0 ; i<CACHE_BLOCKS && !found ; i++ )
-  {
-    // make sure the cache block is valid and has the tag we are searching for
-    if ( cache_directory[i].valid && (cache_directory[i].tag == tag))
+  // make sure the cache block is valid
+  // that is make sure this cache block contains a real cache entry that has been explicitly loaded from main memory
+  // a decoupled cache only keeps tags, main memory is already up to date but the DRAM still sees the write
+  if ( cache->directory[ca_index].valid && decoupled && dram_banks > 0 )
+    dram_access( cache->directory[ca_index].tag << block_offset, block_size, true );
+  if ( cache->directory[ca_index].valid && !decoupled ) {
+    // the tag specifies the block we should be writing to in main memory
+    block = data_word( cache->directory[ca_index].tag << block_offset, true );
+    cached = cache_word( cache, ca_index, 0 );
+
+    // writes a specified block in the cache to the appropriate location in main memory
+    // with sectors only the ones that changed go back
+    if ( sectors > 0 )
     {
-      block_index = i;
-      found = true;
+      for ( int i=0 ; i<sectors ; i++ )
+      {
+        if ( cache->sector_dirty[ca_index] & (1u << i) )
+        {
+          memcpy( block + i*sector_words*WORD_SIZE, cached + i*sector_words*WORD_SIZE, sector_words*WORD_SIZE );
+          cache->words_written += sector_words;
+          if ( dram_banks > 0 )
+            dram_access( (cache->directory[ca_index].tag << block_offset) + i*sector_words, sector_words, true );
+        }
+      }
+      cache->sector_dirty[ca_index] = 0;
+    }
+    else
+    {
+      memcpy( block, cached, block_size*WORD_SIZE );
+      cache->words_written += block_size;
+      if ( dram_banks > 0 )
+        dram_access( cache->directory[ca_index].tag << block_offset, block_size, true );
     }
   }
-  return found;
 }
 
-// this function applies the demand fetch policy to check the cache for the requested data to load into the cache
-// if the data is not in the cache, it will load it into the appropriate cache block from main memory
-unsigned short load_data()
-{   
-  unsigned short data; // data eventually to be loaded to the MDR
-  unsigned short memory_tag; // tag variable containing tag extracted from MAR
-  int offset;  // offset variable containing offset extracted from MAR
-  bool found; // boolean variable determining whether we have found the block containing the requested data to load 
-  int block_index;  // index of a cache block in the cache
 
-  memory_tag = state.MAR >> BLOCK_OFFSET; // extract tag from MAR
-  offset = state.MAR & (BLOCK_SIZE - 1);  // extract offset from MAR
+// makes sure the sector with the passed word of a block is in the cache, reading it from main memory if
+// it isn't. writing a sector of a single word doesn't need the old word
+// returns true if the sector had to be filled
+bool fill_sector( struct CACHE *cache, int block_index, int offset, bool write )
+{
+  int sector = offset >> sector_offset;
+  int first = sector * sector_words;
 
-  // returns true if we found the cache block containing requested data to be eventually loaded into the MDR
-  found = find_block(memory_tag, block_index );
+  if ( cache->sector_valid[block_index] & (1u << sector) )
+    return false;
 
-  // if requested data to load to the MDR is in the cache
-  // get the data from the appropriate cache block
-  if (found) 
+  if ( !(write && sector_words == 1) )
   {
-    // Combine the two individual bytes to a word so we can load it into the MDR assuming big endian
-    data = cache_memory[block_index][offset][0] << 8;
-    data <<= 8;
-    data |= cache_memory[block_index][offset][1];
+    memcpy( cache_word( cache, block_index, first ),
+           data_word( (cache->directory[block_index].tag << block_offset) + first, false ), sector_words*WORD_SIZE );
+    cache->words_read += sector_words;
+    if ( dram_banks > 0 )
+      dram_access( (cache->directory[block_index].tag << block_offset) + first, sector_words, false );
+  }
+  cache->sector_valid[block_index] |= 1u << sector;
 
-    // set that cache block to block containing most recently used entry
-    lru_global_counter = lru_global_counter + 1;
-    cache_directory[block_index].reference_count = lru_global_counter;
+  return true;
+}
 
-    // track hits
-    hits = hits + 1;
 
-  }
-  // if requested data to load to the MDR is not in the cache, load from main memory
-  else
-  {
-    block_index = read_block( state.MAR );  // index of cache block that has just been loaded with block from main memory
+// returns the first byte of a block in the victim cache
+unsigned char *victim_word( struct CACHE *cache, int victim_index )
+{
+  return &cache->victim_memory[victim_index*block_size*WORD_SIZE];
+}
 
-    // Combine the two individual bytes to a word so we can load it into the MDR assuming big endian
-    data = cache_memory[block_index][offset][0];
-    data <<= 8;
-    data |= cache_memory[block_index][offset][1];
 
-    // track misses
-    misses = misses + 1;
+// looks for the block with the passed tag in the victim cache
+// returns its index, or -1 if it isn't there
+int find_victim( struct CACHE *cache, unsigned short tag )
+{
+  int victim_index = -1;
+  int i;
+
+  for ( i=0 ; i<victim_blocks && victim_index<0 ; i++ )
+  {
+    if ( cache->victims[i].valid && cache->victims[i].tag == tag )
+      victim_index = i;
   }
-  return data;
+
+  return victim_index;
 }
 
 
-// stores data into the cache, if present
-// if the data is not in the cache, load the data from main memory to the cache
-void store_data(unsigned short memory_data)
+// picks the victim cache entry to make room in, an empty one or else the one that has been there longest.
+// a dirty block leaving the victim cache is written back to main memory
+int replace_victim( struct CACHE *cache )
 {
-  unsigned char data_byte1; // first byte of word(2 bytes) extracted from passed data (assuming BIG ENDIAN)
-  unsigned char data_byte2; // second byte of word(2 bytes) extracted from passed data (assuming BIG ENDIAN)
-  unsigned short memory_tag; // tag extracted from MAR
-  int offset;  // offset extracted from MAR
-  bool found; // for loop stop condition
-  int block_index; // cache index
-
-  memory_tag = state.MAR >> BLOCK_OFFSET;   // extract tag from MAR
-  offset = state.MAR & (BLOCK_SIZE - 1);  // extract offset from MAR
-
-  data_byte1 = memory_data >> 8;  // extracting the first byte of the word(2 bytes) from passed data (assuming BIG ENDIAN)
-  data_byte2 = memory_data & 0x00FF;  // extracting the second byte of the word(2 bytes) from passed data (assuming BIG ENDIAN)
+  int victim_index = 0;
+  int i;
 
-  // returns true if we found the cache block containing data to be stored into the cache is present
-  found = find_block(memory_tag, block_index );
+  for ( i=1 ; i<victim_blocks && cache->victims[victim_index].valid ; i++ )
+  {
+    if ( !cache->victims[i].valid || cache->victims[i].reference_count < cache->victims[victim_index].reference_count )
+      victim_index = i;
+  }
 
-  // if the data is present in the cache, store the passed data(memory_data) into the appropriate cache block
-  if (found) 
+  if ( cache->victims[victim_index].dirty )
   {
-    cache_memory[block_index][offset][0] = data_byte1;  // store the first byte extracted from passed data to appropriate cache block location
-    cache_memory[block_index][offset][1] = data_byte2;  // store the second byte extracted from passed data to appropriate cache block location
-    cache_directory[block_index].dirty = true;   // set the dirty bit of that cache index to 1(true)
+    if ( !decoupled )
+      memcpy( data_word( cache->victims[victim_index].tag << block_offset, true ),
+             victim_word( cache, victim_index ), block_size*WORD_SIZE );
+    cache->victims[victim_index].dirty = false;
+    cache->writebacks++;
+    cache->words_written += block_size;
+    if ( dram_banks > 0 )
+      dram_access( cache->victims[victim_index].tag << block_offset, block_size, true );
+  }
 
-    // set that cache index to be the most recently used by incrementing the global counter variable
-    // and assigning it to the reference count of that cache block
-    lru_global_counter = lru_global_counter + 1;
-    cache_directory[block_index].reference_count = lru_global_counter;
+  return victim_index;
+}
 
-    // track hits
-    hits = hits + 1;
-  }
-  // if not in cache, load from memory
-  else
-  {    
-    block_index = read_block( state.MAR ); // index of cache block that has just been loaded with block from main memory
 
-    // use the cache index and offset to determine the appropriate location in the cache to store the 2 bytes extracted from passed data(memory_data)
-    cache_memory[block_index][offset][0] = data_byte1;  // store the first byte extracted from passed data to appropriate cache block location
-    cache_memory[block_index][offset][1] = data_byte2;  // store the second byte extracted from passed data to appropriate cache block location
-    cache_directory[block_index].dirty = true;   // set the dirty bit of that cache index to 1(true)
+// swaps a cache block (directory entry and contents) with an entry in the victim cache,
+// the block going into the victim cache becomes its newest entry
+void swap_victim( struct CACHE *cache, int cache_index, int victim_index )
+{
+  struct DIRECTORY entry = cache->directory[cache_index];
 
-    // track misses
-    misses = misses + 1;  
-  }
+  unindex_block( cache, cache_index );
+  cache->directory[cache_index] = cache->victims[victim_index];
+  index_block( cache, cache_index );
+  cache->victims[victim_index] = entry;
+  cache->victims[victim_index].reference_count = ++cache->lru_global_counter;
+
+  swap_ranges( cache_word( cache, cache_index, 0 ), cache_word( cache, cache_index, 0 ) + block_size*WORD_SIZE,
+              victim_word( cache, victim_index ) );
 }
 
 
-// this function flushes out dirty blocks in the cache to main memory after the program is complete
-void cache_flush()
+// broadcasts a bus request for the block with the passed tag to every other core's cache (and victim cache).
+// on a read, a modified copy is written back to main memory and every copy becomes shared.
+// on a read for ownership (exclusive), every copy is also invalidated.
+// returns true if some other cache had the block
+bool snoop_bus( struct CACHE *cache, unsigned short tag, bool exclusive )
 {
-  int i; // loop counter variable
+  bool shared = false;  // did anybody else have it
+  int i;
+  int block_index;
+  struct CACHE *other;
+  struct DIRECTORY *entry;  // the other cache's directory entry for the block
+  unsigned char *block;     // and the block itself
 
-  // check each cache block for dirtiness
-  // if cache block is dirty, write cache block to main memory
-  for( i=0 ; i<CACHE_BLOCKS ; i++ )
+  for ( i=0 ; i<num_cores ; i++ )
   {
-    if( cache_directory[i].dirty )
+    other = &cores[i].cache;
+    entry = NULL;
+
+    if ( other != cache )
     {
-      // write dirty cache block to memory
-      write_block(i);
-      cache_directory[i].dirty = false;
+      if ( find_block( other, tag, block_index ) )
+      {
+        entry = &other->directory[block_index];
+        block = cache_word( other, block_index, 0 );
+
+        // an invalidated block has to leave the index, but it keeps its place in the recency list
+        // since it'll be filled again before the cache is full
+        if ( exclusive )
+          unindex_block( other, block_index );
+      }
+      else if ( victim_blocks > 0 && (block_index = find_victim( other, tag )) >= 0 )
+      {
+        entry = &other->victims[block_index];
+        block = victim_word( other, block_index );
+      }
+    }
+
+    if ( entry != NULL )
+    {
+      shared = true;
+
+      // a modified block is the only up to date copy, so it has to go back to memory first
+      if ( entry->dirty )
+      {
+        memcpy( data_word( tag << block_offset, true ), block, block_size*WORD_SIZE );
+        entry->dirty = false;
+        other->interventions++;
+        other->words_written += block_size;
+        if ( dram_banks > 0 )
+          dram_access( tag << block_offset, block_size, true );
+      }
+
+      if ( exclusive )
+      {
+        entry->valid = false;
+        other->lost[tag] = true;
+        cache->invalidations++;
+      }
+      else
+        entry->shared = true;
+    }
+  }
+
+  return shared;
+}
+
+
+// keeps the shadow cache up to date with an access to the block with the passed tag
+// returns true if the shadow cache had the block
+bool touch_shadow( struct CACHE *cache, unsigned short tag )
+{
+  int slot = cache->shadow_slots[tag];
+  bool found = slot >= 0;
+
+  // the empty slots are the oldest until they've all been used, so we either fill one or replace
+  // the least recently used
+  if ( !found )
+  {
+    slot = cache->shadow_recency.oldest;
+
+    if ( cache->shadow_used < cache_blocks )
+      cache->shadow_used++;
+    else
+      cache->shadow_slots[cache->shadow_tags[slot]] = -1;
+    cache->shadow_tags[slot] = tag;
+    cache->shadow_slots[tag] = slot;
+  }
+
+  promote( &cache->shadow_recency, slot );
+
+  return found;
+}
+
+
+// works out whether a miss on the block with the passed tag is compulsory, capacity or conflict.
+// this has to happen before the block is read, while we can still tell if another cache invalidated it,
+// since those are coherence misses instead
+void classify_miss( struct CACHE *cache, unsigned short tag )
+{
+  bool shadow_hit = touch_shadow( cache, tag );
+
+  if ( !cache->seen[tag] )
+  {
+    cache->seen[tag] = true;
+    cache->compulsory_misses++;
+  }
+  else if ( num_cores > 1 && cache->lost[tag] )
+  {
+    // a coherence miss, read_block() counts it when it reads the block back in
+  }
+  else if ( shadow_hit )
+    cache->conflict_misses++;
+  else
+    cache->capacity_misses++;
+}
+
+
+// The cache model. It's a template so that the geometries we use all the time get their loop bounds,
+// shifts and masks as compile time constants. A BLOCKS or WORDS of 0 (or a POLICY of NUM_POLICIES)
+// means the setting isn't fixed and comes from the runtime configuration instead, which gives us the
+// generic model that handles everything else.
+template <int BLOCKS, int WORDS, int POLICY>
+struct CACHE_MODEL
+{
+  static inline int blocks()  { return BLOCKS ? BLOCKS : cache_blocks; }
+  static inline int words()   { return WORDS ? WORDS : block_size; }
+  static inline int offset()  { return WORDS ? log2_of( WORDS ) : block_offset; }
+  static inline int policy()  { return POLICY < NUM_POLICIES ? POLICY : cache_policy; }
+
+  // returns the first byte of the passed word of a block in the cache
+  static inline unsigned char *word_at( struct CACHE *cache, int block_index, int offset )
+  {
+    return &cache->memory[(block_index*words() + offset)*WORD_SIZE];
+  }
+
+
+  // this function returns the index of the first empty block in the cache
+  // tf there are no empty blocks, this function returns -1
+  static int get_empty_block( struct CACHE *cache ) {
+    bool found = cache->valid_blocks == blocks(); // for loop stop condition, a full cache has nothing to find
+    int empty_block_index = -1; // initially set to -1 to indicate that there are no empty blocks
+
+    // loop through the cache directory,
+    // if an empty cache block is found (valid bit is not set i.e valid = false),
+    // exit the loop immediately and return the index of that empty cache block
+    // if an empty cache block is not found, return -1
+    for ( int i = 0; i < blocks() && !found; i++ ) {
+        if ( !(cache->directory[i].valid) ) {
+            empty_block_index = i;
+            found = true;
+        }
+    }
+      return empty_block_index;
+  }
+
+
+  // finds the cache block to replace once the cache is full.
+  // for LRU and FIFO that's the block with the smallest reference count (they only differ in
+  // whether a hit updates it), which is always the oldest block in the recency list
+  static int victim_block( struct CACHE *cache ) {
+    int lru_block_index = cache->recency.oldest;  // index of the cache block containing the least recently used entry
+
+    if ( policy() == RANDOM_POLICY ) {
+      // our own generator keeps runs repeatable
+      cache->random = cache->random*1103515245 + 12345;
+      lru_block_index = (int)((cache->random >> 16) % blocks());
+    }
+    return lru_block_index;
+  }
+
+
+  // loads a block from main memory into the cache
+  // first checks to load an empty block in the cache
+  // if it does not find an empty block, it finds the least recently used block and loads data into it
+  // exclusive is set when the block is being loaded to be written, so other copies are invalidated
+  // returns the index of cache block that the block from main memory was loaded into 
+  static int read_block( struct CACHE *cache, unsigned short address, bool exclusive )
+  {
+    int cache_index; // the cache index of the empty cache block or the cache block containing the least recently used entry
+    int victim_index = -1; // where the block is in the victim cache, if it's there
+    unsigned short memory_address; // address in main memory
+
+    // extracts the tag from the passed address
+    memory_address = address;
+    memory_address >>= offset();
+
+    // first checks to see if there is an empty cache block
+    // recall from find_empty_block(), that it returns -1 if there are no empty cache blocks
+    // if there is an empty cache block, assign the index of the empty cache block to cache_index
+    // if there is not an empty cache block, then it gets the index of the cache block containing the least recently used entry
+    // a program with its own partition of the cache only replaces its own blocks
+    if ( !programs.empty() && programs[current_program].blocks > 0 )
+      cache_index = partition_block( cache );
+    else
+    {
+      cache_index = get_empty_block( cache );
+      if ( cache_index < 0 ) {
+        cache_index = victim_block( cache );  
+      }
+    }
+
+    // taking turns, count who threw out whose block
+    if ( !programs.empty() && cache->directory[cache_index].valid )
+      count_eviction( cache->directory[cache_index].tag );
+
+    // with a victim cache the block we're replacing isn't gone yet, it's swapped into the victim cache.
+    // if the victim cache has the block we want it swaps places with that (a miss the victim cache absorbed),
+    // otherwise it takes the place of the victim cache's oldest block
+    if ( victim_blocks > 0 )
+    {
+      victim_index = find_victim( cache, memory_address );
+      if ( victim_index >= 0 )
+      {
+        swap_victim( cache, cache_index, victim_index );
+        cache->victim_hits++;
+      }
+      else if ( cache->directory[cache_index].valid )
+        swap_victim( cache, cache_index, replace_victim( cache ) );
+    }
+      
+    // using write-back update policy
+    // if the cache block is dirty, write that block to main memory
+    // then set the dirty bit to 0(that is dirty = false)
+    // a block back from the victim cache isn't leaving, so it stays dirty until it does
+    if( victim_index < 0 && cache->directory[cache_index].dirty )
+    {
+      write_block( cache, cache_index );
+      cache->directory[cache_index].dirty = false;
+      cache->writebacks++;
+    }
+
+    // takes the cache index of the empty cache block 
+    // or the cache index of the cache block containing the least recently used entry
+    // make that cache block, the most recently used
+    cache->lru_global_counter = cache->lru_global_counter + 1;
+    cache->directory[cache_index].reference_count = cache->lru_global_counter;
+    promote( &cache->recency, cache_index );
+
+    // a block back from the victim cache keeps its state, it only needs the bus if we're about to write a shared copy
+    if ( victim_index >= 0 )
+    {
+      if ( exclusive && cache->directory[cache_index].shared )
+      {
+        snoop_bus( cache, memory_address, true );
+        cache->directory[cache_index].shared = false;
+        cache->upgrades++;
+      }
+      return cache_index;
+    }
+
+    // the other caches have to see the request before we read memory, so a modified copy gets written back first
+    // with a single core there's nobody to ask and every block is exclusive
+    cache->directory[cache_index].shared = false;
+    if ( num_cores > 1 )
+    {
+      // a miss on a block somebody else invalidated is a coherence miss
+      if ( cache->lost[memory_address] )
+      {
+        cache->coherence_misses++;
+        cache->lost[memory_address] = false;
+      }
+
+      cache->directory[cache_index].shared = snoop_bus( cache, memory_address, exclusive ) && !exclusive;
+    }
+
+    // The cache block is now valid since we have explicitly loaded data from main memory array into it 
+    unindex_block( cache, cache_index );
+    cache->directory[cache_index].valid = true; 
+    cache->directory[cache_index].tag = memory_address;
+    index_block( cache, cache_index );
+
+    // copies a block from main memory and stores it in the appropriate cache block
+    // reading never allocates a page, untouched memory just reads as filler
+    // with sectors only the sector we want comes in
+    if ( sectors > 0 )
+    {
+      cache->sector_valid[cache_index] = 0;
+      fill_sector( cache, cache_index, address & (words() - 1), exclusive );
+    }
+    else
+    {
+      if ( !decoupled )
+        memcpy( word_at( cache, cache_index, 0 ), data_word( memory_address << offset(), false ), words()*WORD_SIZE );
+      cache->words_read += words();
+      if ( dram_banks > 0 )
+        dram_access( memory_address << offset(), words(), false );
+    }
+    return cache_index;
+  }
+
+
+  // looks for the cache block in the cache directory with the same tag as the passed tag 
+  // returns true if found, false otherwise
+  // if found, sets block_index variable, so we can identify the cache block
+  static bool find_block( struct CACHE *cache, unsigned short tag, int &block_index )
+  {
+    int i = cache->tag_index[tag];  // only valid blocks are in the index
+
+    if ( i >= 0 )
+      block_index = i;
+
+    return i >= 0;
+  }
+
+
+  // this function applies the demand fetch policy to check the cache for the requested data to load into the cache
+  // if the data is not in the cache, it will load it into the appropriate cache block from main memory
+  static unsigned short load_data( struct CACHE *cache, unsigned short address )
+  {   
+    unsigned short data; // data eventually to be loaded to the MDR
+    unsigned short memory_tag; // tag variable containing tag extracted from the address
+    int offset;  // offset variable containing offset extracted from the address
+    bool found; // boolean variable determining whether we have found the block containing the requested data to load 
+    int block_index;  // index of a cache block in the cache
+    unsigned char *word; // the requested word in the cache
+
+    memory_tag = address >> CACHE_MODEL::offset(); // extract tag from the address
+    offset = address & (words() - 1);  // extract offset from the address
+
+    // returns true if we found the cache block containing requested data to be eventually loaded into the MDR
+    found = find_block( cache, memory_tag, block_index );
+
+    // if requested data to load to the MDR is in the cache
+    // get the data from the appropriate cache block
+    if (found) 
+    {
+      // set that cache block to block containing most recently used entry
+      if ( policy() == LRU_POLICY ) {
+        cache->lru_global_counter = cache->lru_global_counter + 1;
+        cache->directory[block_index].reference_count = cache->lru_global_counter;
+        promote( &cache->recency, block_index );
+      }
+
+      // track hits, the block can be here without the sector we want
+      touch_shadow( cache, memory_tag );
+      if ( sectors > 0 && fill_sector( cache, block_index, offset, false ) )
+      {
+        cache->sector_misses++;
+        cache->misses = cache->misses + 1;
+      }
+      else
+        cache->hits = cache->hits + 1;
+
+      // Combine the two individual bytes to a word so we can load it into the MDR assuming big endian
+      word = word_at( cache, block_index, offset );
+      data = word[0];
+      data <<= 8;
+      data |= word[1];
+    }
+    // if requested data to load to the MDR is not in the cache, load from main memory
+    else
+    {
+      classify_miss( cache, memory_tag );
+      block_index = read_block( cache, address, false );  // index of cache block that has just been loaded with block from main memory
+
+      // Combine the two individual bytes to a word so we can load it into the MDR assuming big endian
+      word = word_at( cache, block_index, offset );
+      data = word[0];
+      data <<= 8;
+      data |= word[1];
+
+      // track misses
+      cache->misses = cache->misses + 1;
+    }
+    return data;
+  }
+
+
+  // stores data into the cache, if present
+  // if the data is not in the cache, load the data from main memory to the cache
+  static void store_data( struct CACHE *cache, unsigned short address, unsigned short memory_data )
+  {
+    unsigned short memory_tag; // tag extracted from the address
+    int offset;  // offset extracted from the address
+    bool found; // for loop stop condition
+    int block_index; // cache index
+    unsigned char *word; // where the word goes in the cache
+
+    memory_tag = address >> CACHE_MODEL::offset();   // extract tag from the address
+    offset = address & (words() - 1);  // extract offset from the address
+
+    // returns true if we found the cache block containing data to be stored into the cache is present
+    found = find_block( cache, memory_tag, block_index );
+
+    // if the data is present in the cache, store the passed data(memory_data) into the appropriate cache block
+    if (found) 
+    {
+      // a shared block has to be claimed before we can write it, every other copy gets invalidated
+      if ( cache->directory[block_index].shared )
+      {
+        snoop_bus( cache, memory_tag, true );
+        cache->directory[block_index].shared = false;
+        cache->upgrades++;
+      }
+
+      // set that cache index to be the most recently used by incrementing the global counter variable
+      // and assigning it to the reference count of that cache block
+      if ( policy() == LRU_POLICY ) {
+        cache->lru_global_counter = cache->lru_global_counter + 1;
+        cache->directory[block_index].reference_count = cache->lru_global_counter;
+        promote( &cache->recency, block_index );
+      }
+
+      // track hits, the block can be here without the sector we want
+      touch_shadow( cache, memory_tag );
+      if ( sectors > 0 && fill_sector( cache, block_index, offset, true ) )
+      {
+        cache->sector_misses++;
+        cache->misses = cache->misses + 1;
+      }
+      else
+        cache->hits = cache->hits + 1;
+    }
+    // if not in cache, load from memory
+    else
+    {    
+      classify_miss( cache, memory_tag );
+      block_index = read_block( cache, address, true ); // index of cache block that has just been loaded with block from main memory
+
+      // track misses
+      cache->misses = cache->misses + 1;  
+    }
+
+    // store the passed data (assuming BIG ENDIAN) into the appropriate cache block location
+    word = word_at( cache, block_index, offset );
+    word[0] = memory_data >> 8;
+    word[1] = memory_data & 0x00FF;
+    cache->directory[block_index].dirty = true;   // set the dirty bit of that cache index to 1(true)
+    if ( sectors > 0 )
+      cache->sector_dirty[block_index] |= 1u << (offset >> sector_offset);
+  }
+};
+
+
+// a compiled version of the cache model and the geometry it was compiled for
+struct MODEL_ENTRY
+{
+  int blocks;
+  int words;
+  int policy;
+  unsigned short (*load)( struct CACHE *, unsigned short );
+  void (*store)( struct CACHE *, unsigned short, unsigned short );
+  bool (*find)( struct CACHE *, unsigned short, int & );
+};
+
+#define MODEL(blocks, words, policy) \
+  { blocks, words, policy, CACHE_MODEL<blocks, words, policy>::load_data, \
+    CACHE_MODEL<blocks, words, policy>::store_data, CACHE_MODEL<blocks, words, policy>::find_block }
+
+#define LRU_MODELS(blocks) \
+  MODEL(blocks, 1, LRU_POLICY), MODEL(blocks, 2, LRU_POLICY), \
+  MODEL(blocks, 4, LRU_POLICY), MODEL(blocks, 8, LRU_POLICY)
+
+// the geometries we sweep most often get their own specialized model,
+// the generic one at the end handles anything else
+static struct MODEL_ENTRY cache_models[] =
+{
+  LRU_MODELS(1), LRU_MODELS(2), LRU_MODELS(4), LRU_MODELS(8),
+  LRU_MODELS(16), LRU_MODELS(32), LRU_MODELS(64),
+  MODEL(0, 0, NUM_POLICIES)
+};
+
+
+// points the cache routines at the specialized model for the configured geometry,
+// or at the generic model if there isn't one
+void select_cache_model()
+{
+  int i = 0;
+
+  while ( !( cache_models[i].blocks == cache_blocks && cache_models[i].words == block_size &&
+             cache_models[i].policy == cache_policy ) && cache_models[i].blocks != 0 )
+    i++;
+
+  load_data = cache_models[i].load;
+  store_data = cache_models[i].store;
+  find_block = cache_models[i].find;
+}
+
+
+// copies the host thread's cache geometry and routines into the passed geometry
+void get_geometry( struct GEOMETRY *geometry )
+{
+  geometry->blocks = cache_blocks;
+  geometry->words = block_size;
+  geometry->offset = block_offset;
+  geometry->load = load_data;
+  geometry->store = store_data;
+  geometry->find = find_block;
+}
+
+
+// makes the passed geometry the host thread's, see get_geometry()
+void use_geometry( const struct GEOMETRY *geometry )
+{
+  cache_blocks = geometry->blocks;
+  block_size = geometry->words;
+  block_offset = geometry->offset;
+  load_data = geometry->load;
+  store_data = geometry->store;
+  find_block = geometry->find;
+}
+
+
+// the fast functional mode's memory access, straight to main memory without any cache bookkeeping
+unsigned short functional_load( struct CACHE *, unsigned short address )
+{
+  unsigned char *word = data_word( address, false );
+
+  skipped_accesses++;
+  return (word[0] << 8) | word[1];
+}
+
+
+void functional_store( struct CACHE *, unsigned short address, unsigned short memory_data )
+{
+  unsigned char *word = data_word( address, true );
+
+  skipped_accesses++;
+  word[0] = memory_data >> 8;
+  word[1] = memory_data & 0x00FF;
+}
+
+
+// reloads every block in the cache (and victim cache) from main memory, keeping the directory as it is.
+// main memory may have changed underneath a clean block while we were fast forwarding
+void cache_refresh( struct CACHE *cache )
+{
+  int i;
+
+  for ( i=0 ; i<cache_blocks ; i++ )
+  {
+    if ( cache->directory[i].valid )
+      memcpy( cache_word( cache, i, 0 ), data_word( cache->directory[i].tag << block_offset, false ), block_size*WORD_SIZE );
+  }
+
+  for ( i=0 ; i<victim_blocks ; i++ )
+  {
+    if ( cache->victims[i].valid )
+      memcpy( victim_word( cache, i ), data_word( cache->victims[i].tag << block_offset, false ), block_size*WORD_SIZE );
+  }
+}
+
+
+// this function flushes out dirty blocks in the cache to main memory after the program is complete
+void cache_flush( struct CACHE *cache )
+{
+  int i; // loop counter variable
+
+  // check each cache block for dirtiness
+  // if cache block is dirty, write cache block to main memory
+  for( i=0 ; i<cache_blocks ; i++ )
+  {
+    if( cache->directory[i].dirty )
+    {
+      // write dirty cache block to memory
+      write_block( cache, i );
+      cache->directory[i].dirty = false;
+    }
+  }
+
+  // the victim cache can be holding modified blocks too
+  for( i=0 ; i<victim_blocks ; i++ )
+  {
+    if( cache->victims[i].valid && cache->victims[i].dirty )
+    {
+      if ( !decoupled )
+        memcpy( data_word( cache->victims[i].tag << block_offset, true ), victim_word( cache, i ), block_size*WORD_SIZE );
+      cache->victims[i].dirty = false;
+      cache->words_written += block_size;
+      if ( dram_banks > 0 )
+        dram_access( cache->victims[i].tag << block_offset, block_size, true );
+    }
+  }
+}
+
+
+// Prints report indicating the cache hits, misses and hit rate achieved
+void print_statistics( struct CACHE *cache )
+{
+  const char *policy_names[NUM_POLICIES] = { "LRU", "FIFO", "random" };
+
+  // LRU is what we always used, so only mention the others
+  if ( cache_policy == LRU_POLICY )
+    printf( "Cache report for fully associative cache with %d block(s) of %d word(s) each:\n", cache_blocks, block_size);
+  else
+    printf( "Cache report for fully associative cache with %d block(s) of %d word(s) each, %s replacement:\n",
+           cache_blocks, block_size, policy_names[cache_policy]);
+
+  // if program does loads or stores, report the hits, misses and overall hit rate
+  // if program does no loads or stores, report the hits as 0, misses as 0 and overall hit rate as 0.00 (This is done to prevent div by 0 error)
+  printf( "Hits: %d\nMisses: %d\n", cache->hits, cache->misses);
+  if( cache->hits + cache->misses > 0 )
+    printf( "Overall hit rate: %.2f%%\n\n", ((float)cache->hits / (float)(cache->hits + cache->misses))*100);
+  else 
+    printf( "Overall hit rate: %.2f%%\n\n", 0.0);
+
+  // what a miss tells us to change: compulsory misses want bigger blocks, capacity misses a bigger cache
+  // and conflict misses a better replacement policy (the cache is already fully associative)
+  printf( "Compulsory misses: %d\nCapacity misses: %d\nConflict misses: %d\n",
+         cache->compulsory_misses, cache->capacity_misses, cache->conflict_misses );
+
+  // with sectors a miss can also be on a cached block without the sector, which is none of those
+  if ( sectors > 0 )
+    printf( "Sector misses: %d\n", cache->sector_misses );
+  printf( "\n" );
+
+  // sectoring is about the traffic to main memory
+  if ( sectors > 0 )
+  {
+    printf( "Sectors: %d of %d word(s) per block\n", sectors, sector_words );
+    printf( "Memory traffic: %lu word(s) read, %lu word(s) written\n\n", cache->words_read, cache->words_written );
+  }
+
+  // misses the victim cache absorbed didn't have to go to main memory
+  if ( victim_blocks > 0 )
+  {
+    printf( "Victim cache of %d block(s):\n", victim_blocks );
+    printf( "Victim cache hits: %d\nMisses to memory: %d\n\n", cache->victim_hits, cache->misses - cache->victim_hits );
+  }
+
+  // coherence traffic only exists when there's somebody to be coherent with
+  if ( num_cores > 1 )
+  {
+    printf( "Invalidations: %d\nUpgrades: %d\nCoherence misses: %d\nInterventions: %d\n\n",
+           cache->invalidations, cache->upgrades, cache->coherence_misses, cache->interventions );
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////
+// virtual memory routines
+
+
+// finds the frame for a virtual page by walking the page table
+// a page that hasn't been touched yet gets the next free frame (a page fault)
+// returns -1 if we've run out of physical memory
+int walk_page_table( int page )
+{
+  if ( page_table[page] < 0 && next_frame*PAGE_WORDS < data_size )
+  {
+    page_table[page] = next_frame++;
+    page_faults++;
+  }
+
+  return page_table[page];
+}
+
+
+// picks the entry in the passed TLB set to replace, preferring an empty one
+int tlb_victim( struct TLB *tlb, int set_start, int ways )
+{
+  int victim = -1;
+  int i;
+
+  for ( i=set_start ; i<set_start+ways && victim<0 ; i++ )
+  {
+    if ( !tlb->entries[i].valid )
+      victim = i;
+  }
+
+  if ( victim < 0 )
+  {
+    if ( tlb_policy == RANDOM_POLICY )
+    {
+      // our own generator keeps runs repeatable
+      tlb->random = tlb->random*1103515245 + 12345;
+      victim = set_start + (int)((tlb->random >> 16) % ways);
+    }
+
+    // LRU and FIFO both throw out the smallest stamp, they only differ in when it's updated
+    else
+    {
+      victim = set_start;
+      for ( i=set_start+1 ; i<set_start+ways ; i++ )
+      {
+        if ( tlb->entries[i].stamp < tlb->entries[victim].stamp )
+          victim = i;
+      }
+    }
+  }
+
+  return victim;
+}
+
+
+// translates a virtual word address into a physical one, going through the TLB and
+// walking the page table on a miss. returns false if the page can't be mapped
+bool translate_address( unsigned short virtual_address, unsigned short &physical_address )
+{
+  bool found = false;
+  int  page = virtual_address >> PAGE_OFFSET;
+  int  ways = tlb_ways > 0 ? tlb_ways : tlb_entries;
+  int  set_start = (page % (tlb_entries / ways)) * ways;
+  int  frame = -1;
+  int  i;
+  struct TLB *tlb = &core->tlb;
+
+  for ( i=set_start ; i<set_start+ways && !found ; i++ )
+  {
+    if ( tlb->entries[i].valid && tlb->entries[i].page == page )
+    {
+      found = true;
+      frame = tlb->entries[i].frame;
+
+      // only LRU cares about use, FIFO keeps the time the entry was loaded
+      if ( tlb_policy == LRU_POLICY )
+        tlb->entries[i].stamp = ++tlb->counter;
+
+      tlb->hits++;
+    }
+  }
+
+  if ( !found )
+  {
+    tlb->misses++;
+    frame = walk_page_table( page );
+
+    // don't cache a translation that failed
+    if ( frame >= 0 )
+    {
+      i = tlb_victim( tlb, set_start, ways );
+      tlb->entries[i].valid = true;
+      tlb->entries[i].page = page;
+      tlb->entries[i].frame = frame;
+      tlb->entries[i].stamp = ++tlb->counter;
+    }
+  }
+
+  if ( frame >= 0 )
+    physical_address = (frame << PAGE_OFFSET) | (virtual_address & (PAGE_WORDS - 1));
+
+  return frame >= 0;
+}
+
+
+// checks the MAR against data memory, translating it to a physical address first if
+// virtual memory is on. returns false if it's an illegal address
+bool map_address()
+{
+  bool rc = true;
+  unsigned short physical_address;
+  unsigned short used = core->state.MAR;
+
+  // an address outside the layout is left alone, it's about to be an illegal address anyway
+  if ( !remap.empty() && core->state.MAR < remap.size() )
+    core->state.MAR = remap[core->state.MAR];
+
+  // fast forwarding doesn't need the TLB, it just walks the page table
+  if ( tlb_entries > 0 && functional )
+  {
+    rc = walk_page_table( core->state.MAR >> PAGE_OFFSET ) >= 0;
+    if ( rc )
+      core->state.MAR = (page_table[core->state.MAR >> PAGE_OFFSET] << PAGE_OFFSET) | (core->state.MAR & (PAGE_WORDS - 1));
+  }
+
+  else if ( tlb_entries > 0 )
+  {
+    rc = translate_address( core->state.MAR, physical_address );
+    if ( rc )
+      core->state.MAR = physical_address;
+  }
+
+  rc = rc && core->state.MAR < data_size;
+
+  // the layout advisor wants the legal addresses the program used, before they were moved anywhere
+  if ( rc && layout_prefix != NULL )
+    layout_references.push_back( used );
+
+  // each program's addresses are in its own slice of data memory
+  if ( rc && !programs.empty() )
+    core->state.MAR += programs[current_program].base;
+
+  if ( rc && telemetry != NULL )
+    use_block( core->state.MAR >> block_offset );
+
+  return rc;
+}
+
+
+// Prints the TLB hits, misses and what the page walks cost
+void print_tlb_statistics( struct TLB *tlb )
+{
+  const char *policy_names[NUM_POLICIES] = { "LRU", "FIFO", "random" };
+  int ways = tlb_ways > 0 ? tlb_ways : tlb_entries;
+
+  printf( "TLB report for %d entries, %d-way, %s replacement, %d cycle page walks:\n",
+         tlb_entries, ways, policy_names[tlb_policy], walk_cycles );
+  printf( "TLB hits: %d\nTLB misses: %d\n", tlb->hits, tlb->misses );
+  if ( tlb->hits + tlb->misses > 0 )
+    printf( "TLB hit rate: %.2f%%\n", ((float)tlb->hits / (float)(tlb->hits + tlb->misses))*100 );
+  else
+    printf( "TLB hit rate: %.2f%%\n", 0.0 );
+  printf( "Page walk cycles: %lu\n", (unsigned long)tlb->misses * walk_cycles );
+  printf( "Pages mapped: %d (%d words of TLB reach)\n\n", page_faults, ways * (tlb_entries / ways) * PAGE_WORDS );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// DRAM routines
+
+// main memory is a DRAM of dram_banks banks, each with a row buffer holding the row it last opened. an access
+// to the open row only needs the column read (a row buffer hit), a closed bank has to open the row first (a
+// miss) and a bank with another row open has to close it before opening ours (a conflict). the words then
+// come over a burst of DRAM_WORD_CYCLES each. with a closed page policy every bank closes its row after each
+// access, so there are only misses. every block or sector the caches fill or write back is one access
+
+
+// resets the banks, which all start closed
+void initialize_dram()
+{
+  int i;
+
+  memset( &dram, 0, sizeof(dram) );
+  for ( i=0 ; i<MAX_DRAM_BANKS ; i++ )
+    dram.open_row[i] = -1;
+}
+
+
+// reads or writes the passed number of words of main memory from the passed address on, which are all in one
+// row, and counts how long it took
+void dram_access( unsigned short address, int words, bool write )
+{
+  int bank;
+  int row = address / (dram_row * dram_banks);
+  int cycles;
+
+  // interleaving by row puts neighbouring rows in different banks, by block puts neighbouring blocks there
+  if ( dram_block_map )
+    bank = (address >> block_offset) & (dram_banks - 1);
+  else
+    bank = (address / dram_row) & (dram_banks - 1);
+
+  if ( dram.open_row[bank] == row )
+  {
+    cycles = dram_hit;
+    dram.row_hits++;
+  }
+  else if ( dram.open_row[bank] < 0 )
+  {
+    cycles = dram_miss;
+    dram.row_misses++;
+  }
+  else
+  {
+    cycles = dram_conflict;
+    dram.row_conflicts++;
+  }
+  dram.open_row[bank] = dram_closed_page ? -1 : row;
+  cycles += words * DRAM_WORD_CYCLES;
+
+  if ( write )
+  {
+    dram.writes++;
+    dram.write_cycles += cycles;
+  }
+  else
+  {
+    dram.fills++;
+    dram.fill_cycles += cycles;
+  }
+}
+
+
+// reports how often the row buffers had the row already open and how long fills and write-backs took
+void print_dram()
+{
+  unsigned long accesses = dram.row_hits + dram.row_misses + dram.row_conflicts;
+
+  printf( "DRAM report for %d bank(s) of %d word rows, %s page, interleaved by %s:\n", dram_banks, dram_row,
+          dram_closed_page ? "closed" : "open", dram_block_map ? "block" : "row" );
+  printf( "Row buffer hits: %lu\nRow buffer misses: %lu\nRow buffer conflicts: %lu\n", dram.row_hits,
+          dram.row_misses, dram.row_conflicts );
+  printf( "Row buffer hit rate: %.2f%%\n", accesses > 0 ? (double)dram.row_hits / accesses * 100 : 0.0 );
+  printf( "Fills: %lu, %.2f cycles average\n", dram.fills,
+          dram.fills > 0 ? (double)dram.fill_cycles / dram.fills : 0.0 );
+  printf( "Write-backs: %lu, %.2f cycles average\n\n", dram.writes,
+          dram.writes > 0 ? (double)dram.write_cycles / dram.writes : 0.0 );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// checkpoint routines
+
+// a checkpoint is the whole machine as raw bytes: the settings it was taken with, the code, every core
+// (state, registers, cache and TLB) and every data page that has been touched, so restoring it is
+// mostly a handful of memcpy calls
+
+#define CHECKPOINT_MAGIC    "SIMCKPT1"
+#define CHECKPOINT_SETTINGS 11 // data size, cores, cache, victim cache and TLB settings, and the number of data pages
+
+
+// appends raw bytes to a checkpoint
+void put_bytes( vector<unsigned char> &image, const void *bytes, size_t length )
+{
+  const unsigned char *first = (const unsigned char *)bytes;
+
+  image.insert( image.end(), first, first + length );
+}
+
+
+// copies raw bytes out of a checkpoint, returns false if we've run off the end of it
+bool get_bytes( const vector<unsigned char> &image, size_t &at, void *bytes, size_t length )
+{
+  bool rc = at + length <= image.size();
+
+  if ( rc )
+  {
+    memcpy( bytes, &image[at], length );
+    at += length;
+  }
+
+  return rc;
+}
+
+
+// saves a recency list
+void put_recency( vector<unsigned char> &image, struct RECENCY *recency )
+{
+  put_bytes( image, &recency->newer[0], recency->newer.size() * sizeof(recency->newer[0]) );
+  put_bytes( image, &recency->older[0], recency->older.size() * sizeof(recency->older[0]) );
+  put_bytes( image, &recency->oldest, sizeof(recency->oldest) );
+  put_bytes( image, &recency->newest, sizeof(recency->newest) );
+}
+
+
+// restores a recency list saved by put_recency(), it must already be the right size
+bool get_recency( const vector<unsigned char> &image, size_t &at, struct RECENCY *recency )
+{
+  return get_bytes( image, at, &recency->newer[0], recency->newer.size() * sizeof(recency->newer[0]) ) &&
+         get_bytes( image, at, &recency->older[0], recency->older.size() * sizeof(recency->older[0]) ) &&
+         get_bytes( image, at, &recency->oldest, sizeof(recency->oldest) ) &&
+         get_bytes( image, at, &recency->newest, sizeof(recency->newest) );
+}
+
+
+// saves a cache (directory and its index, memory, victim cache, shadow cache and counters)
+void put_cache( vector<unsigned char> &image, struct CACHE *cache )
+{
+  vector<unsigned char> lost( cache->lost.begin(), cache->lost.end() );
+
+  put_bytes( image, &cache->directory[0], cache_blocks * sizeof(struct DIRECTORY) );
+  put_bytes( image, &cache->tag_index[0], cache->tag_index.size() * sizeof(cache->tag_index[0]) );
+  put_bytes( image, &cache->valid_blocks, sizeof(cache->valid_blocks) );
+  put_recency( image, &cache->recency );
+  put_bytes( image, &cache->memory[0], cache->memory.size() );
+  put_bytes( image, &cache->lru_global_counter, sizeof(cache->lru_global_counter) );
+  put_bytes( image, &cache->random, sizeof(cache->random) );
+  put_bytes( image, &cache->hits, sizeof(cache->hits) );
+  put_bytes( image, &cache->misses, sizeof(cache->misses) );
+  put_bytes( image, &cache->invalidations, sizeof(cache->invalidations) );
+  put_bytes( image, &cache->upgrades, sizeof(cache->upgrades) );
+  put_bytes( image, &cache->coherence_misses, sizeof(cache->coherence_misses) );
+  put_bytes( image, &cache->interventions, sizeof(cache->interventions) );
+  put_bytes( image, &cache->victim_hits, sizeof(cache->victim_hits) );
+  put_bytes( image, &cache->compulsory_misses, sizeof(cache->compulsory_misses) );
+  put_bytes( image, &cache->capacity_misses, sizeof(cache->capacity_misses) );
+  put_bytes( image, &cache->conflict_misses, sizeof(cache->conflict_misses) );
+  put_bytes( image, &cache->seen[0], cache->seen.size() );
+  put_bytes( image, &cache->shadow_tags[0], cache->shadow_tags.size() * sizeof(cache->shadow_tags[0]) );
+  put_recency( image, &cache->shadow_recency );
+  put_bytes( image, &cache->shadow_used, sizeof(cache->shadow_used) );
+  put_bytes( image, &cache->shadow_slots[0], cache->shadow_slots.size() * sizeof(cache->shadow_slots[0]) );
+  if ( !lost.empty() )
+    put_bytes( image, &lost[0], lost.size() );
+  if ( victim_blocks > 0 )
+  {
+    put_bytes( image, &cache->victims[0], victim_blocks * sizeof(struct DIRECTORY) );
+    put_bytes( image, &cache->victim_memory[0], cache->victim_memory.size() );
+  }
+}
+
+
+// restores a cache saved by put_cache(), the cache must already have the same geometry
+bool get_cache( const vector<unsigned char> &image, size_t &at, struct CACHE *cache )
+{
+  bool rc;
+  size_t i;
+  vector<unsigned char> lost( cache->lost.size() );
+
+  rc = get_bytes( image, at, &cache->directory[0], cache_blocks * sizeof(struct DIRECTORY) ) &&
+       get_bytes( image, at, &cache->tag_index[0], cache->tag_index.size() * sizeof(cache->tag_index[0]) ) &&
+       get_bytes( image, at, &cache->valid_blocks, sizeof(cache->valid_blocks) ) &&
+       get_recency( image, at, &cache->recency ) &&
+       get_bytes( image, at, &cache->memory[0], cache->memory.size() ) &&
+       get_bytes( image, at, &cache->lru_global_counter, sizeof(cache->lru_global_counter) ) &&
+       get_bytes( image, at, &cache->random, sizeof(cache->random) ) &&
+       get_bytes( image, at, &cache->hits, sizeof(cache->hits) ) &&
+       get_bytes( image, at, &cache->misses, sizeof(cache->misses) ) &&
+       get_bytes( image, at, &cache->invalidations, sizeof(cache->invalidations) ) &&
+       get_bytes( image, at, &cache->upgrades, sizeof(cache->upgrades) ) &&
+       get_bytes( image, at, &cache->coherence_misses, sizeof(cache->coherence_misses) ) &&
+       get_bytes( image, at, &cache->interventions, sizeof(cache->interventions) ) &&
+       get_bytes( image, at, &cache->victim_hits, sizeof(cache->victim_hits) ) &&
+       get_bytes( image, at, &cache->compulsory_misses, sizeof(cache->compulsory_misses) ) &&
+       get_bytes( image, at, &cache->capacity_misses, sizeof(cache->capacity_misses) ) &&
+       get_bytes( image, at, &cache->conflict_misses, sizeof(cache->conflict_misses) ) &&
+       get_bytes( image, at, &cache->seen[0], cache->seen.size() ) &&
+       get_bytes( image, at, &cache->shadow_tags[0], cache->shadow_tags.size() * sizeof(cache->shadow_tags[0]) ) &&
+       get_recency( image, at, &cache->shadow_recency ) &&
+       get_bytes( image, at, &cache->shadow_used, sizeof(cache->shadow_used) ) &&
+       get_bytes( image, at, &cache->shadow_slots[0], cache->shadow_slots.size() * sizeof(cache->shadow_slots[0]) ) &&
+       (lost.empty() || get_bytes( image, at, &lost[0], lost.size() ));
+  for ( i=0 ; i<lost.size() ; i++ )
+    cache->lost[i] = lost[i];
+
+  if ( rc && victim_blocks > 0 )
+  {
+    rc = get_bytes( image, at, &cache->victims[0], victim_blocks * sizeof(struct DIRECTORY) ) &&
+         get_bytes( image, at, &cache->victim_memory[0], cache->victim_memory.size() );
+  }
+
+  return rc;
+}
+
+
+// takes a checkpoint of the whole machine, which should be between instructions
+void save_checkpoint( vector<unsigned char> &image )
+{
+  int i;
+  int j;
+  int page;
+  size_t length;
+  vector<unsigned char> blob;
+  int settings[CHECKPOINT_SETTINGS] = { data_size, num_cores, cache_blocks, block_size, cache_policy, victim_blocks,
+                                        tlb_entries, tlb_ways, tlb_policy, walk_cycles, 0 };
+
+  // memory has to hold the latest data so the checkpoint can be restored with a different cache.
+  // dirty blocks are copied back but stay dirty, that way the caches behave exactly as if we hadn't stopped
+  for ( i=0 ; i<num_cores ; i++ )
+  {
+    for ( j=0 ; j<cache_blocks ; j++ )
+    {
+      if ( cores[i].cache.directory[j].dirty )
+        write_block( &cores[i].cache, j );
+    }
+    for ( j=0 ; j<victim_blocks ; j++ )
+    {
+      if ( cores[i].cache.victims[j].valid && cores[i].cache.victims[j].dirty )
+        memcpy( data_word( cores[i].cache.victims[j].tag << block_offset, true ),
+               victim_word( &cores[i].cache, j ), block_size*WORD_SIZE );
+    }
+  }
+
+  // writing those blocks back can touch new pages, so count them now
+  settings[CHECKPOINT_SETTINGS-1] = touched_pages.size();
+
+  image.clear();
+  put_bytes( image, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC) );
+  put_bytes( image, settings, sizeof(settings) );
+  put_bytes( image, code, sizeof(code) );
+
+  // virtual memory
+  put_bytes( image, page_table, sizeof(page_table) );
+  put_bytes( image, &next_frame, sizeof(next_frame) );
+  put_bytes( image, &page_faults, sizeof(page_faults) );
+
+  // data memory, only the pages that have been touched
+  for ( i=0 ; i<(int)touched_pages.size() ; i++ )
+  {
+    page = touched_pages[i];
+    put_bytes( image, &page, sizeof(page) );
+    put_bytes( image, data[page], PAGE_WORDS*WORD_SIZE );
+  }
+
+  for ( i=0 ; i<num_cores ; i++ )
+  {
+    put_bytes( image, &cores[i].state, sizeof(cores[i].state) );
+    put_bytes( image, cores[i].registers, sizeof(cores[i].registers) );
+    put_bytes( image, &cores[i].phase, sizeof(cores[i].phase) );
+    put_bytes( image, &cores[i].branch_count, sizeof(cores[i].branch_count) );
+    put_bytes( image, &cores[i].instructions, sizeof(cores[i].instructions) );
+    put_bytes( image, &cores[i].tlb, sizeof(cores[i].tlb) );
+
+    // the cache goes last with its length in front, so a restore with a different cache can skip it
+    blob.clear();
+    put_cache( blob, &cores[i].cache );
+    length = blob.size();
+    put_bytes( image, &length, sizeof(length) );
+    put_bytes( image, &blob[0], length );
+  }
+}
+
+
+// zeroes the counts a checkpoint keeps with a cache
+void clear_statistics( struct CACHE *cache )
+{
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->invalidations = 0;
+  cache->upgrades = 0;
+  cache->coherence_misses = 0;
+  cache->interventions = 0;
+  cache->victim_hits = 0;
+  cache->compulsory_misses = 0;
+  cache->capacity_misses = 0;
+  cache->conflict_misses = 0;
+}
+
+
+// puts the machine back the way it was when the checkpoint was taken. the data memory size, cores and
+// virtual memory settings always come from the checkpoint. the caches are only restored if the cache
+// settings match the checkpoint's, otherwise they start out empty, which is how one checkpoint can
+// be forked into runs with different cache configurations. the cache statistics start from zero either way.
+// returns false if the checkpoint is damaged
+bool restore_checkpoint( const vector<unsigned char> &image )
+{
+  bool rc;
+  bool same_cache;
+  size_t at = 0;
+  size_t length;
+  size_t end;
+  int i;
+  int page;
+  char magic[sizeof(CHECKPOINT_MAGIC)] = "";
+  int settings[CHECKPOINT_SETTINGS];
+
+  rc = get_bytes( image, at, magic, strlen(CHECKPOINT_MAGIC) ) && strcmp( magic, CHECKPOINT_MAGIC ) == 0 &&
+       get_bytes( image, at, settings, sizeof(settings) ) && settings[1] >= 1 && settings[1] <= MAX_CORES;
+
+  if ( rc )
+  {
+    data_size = settings[0];
+    num_cores = settings[1];
+    tlb_entries = settings[6];
+    tlb_ways = settings[7];
+    tlb_policy = (Policy)settings[8];
+    walk_cycles = settings[9];
+    same_cache = cache_blocks == settings[2] && block_size == settings[3] && cache_policy == settings[4] &&
+                 victim_blocks == settings[5];
+    if ( num_cores == 1 )
+      threaded = false;
+
+    initialize_system();
+
+    rc = get_bytes( image, at, code, sizeof(code) ) &&
+         get_bytes( image, at, page_table, sizeof(page_table) ) &&
+         get_bytes( image, at, &next_frame, sizeof(next_frame) ) &&
+         get_bytes( image, at, &page_faults, sizeof(page_faults) );
+
+    for ( i=0 ; i<settings[CHECKPOINT_SETTINGS-1] && rc ; i++ )
+    {
+      rc = get_bytes( image, at, &page, sizeof(page) ) && page >= 0 && page < DATA_PAGES &&
+           get_bytes( image, at, data_word( page * PAGE_WORDS, true ), PAGE_WORDS*WORD_SIZE );
+    }
+
+    for ( i=0 ; i<num_cores && rc ; i++ )
+    {
+      rc = get_bytes( image, at, &cores[i].state, sizeof(cores[i].state) ) &&
+           get_bytes( image, at, cores[i].registers, sizeof(cores[i].registers) ) &&
+           get_bytes( image, at, &cores[i].phase, sizeof(cores[i].phase) ) &&
+           get_bytes( image, at, &cores[i].branch_count, sizeof(cores[i].branch_count) ) &&
+           get_bytes( image, at, &cores[i].instructions, sizeof(cores[i].instructions) ) &&
+           get_bytes( image, at, &cores[i].tlb, sizeof(cores[i].tlb) ) &&
+           get_bytes( image, at, &length, sizeof(length) ) && at + length <= image.size();
+
+      // memory is already up to date, so a different cache just starts out empty. the same cache keeps its
+      // blocks but not its counts, so either way the statistics only cover what happens after the checkpoint
+      if ( rc )
+      {
+        end = at + length;
+        if ( same_cache )
+          rc = get_cache( image, at, &cores[i].cache ) && at == end;
+        at = end;
+        clear_statistics( &cores[i].cache );
+      }
+    }
+  }
+
+  return rc;
+}
+
+
+// writes a checkpoint out to a file, returns false if it couldn't be written
+bool write_checkpoint( const char *file_name, const vector<unsigned char> &image )
+{
+  bool rc = false;
+  FILE *file = fopen( file_name, "wb" );
+
+  if ( file != NULL )
+  {
+    rc = fwrite( &image[0], 1, image.size(), file ) == image.size();
+    rc = fclose( file ) == 0 && rc;
+  }
+
+  if ( !rc )
+    printf( "couldn't write the checkpoint to %s\n", file_name );
+
+  return rc;
+}
+
+
+// reads a whole checkpoint file in, returns false if it couldn't be read
+bool read_checkpoint( const char *file_name, vector<unsigned char> &image )
+{
+  bool rc = false;
+  long length;
+  FILE *file = fopen( file_name, "rb" );
+
+  if ( file != NULL )
+  {
+    fseek( file, 0, SEEK_END );
+    length = ftell( file );
+    fseek( file, 0, SEEK_SET );
+    if ( length > 0 )
+    {
+      image.resize( length );
+      rc = fread( &image[0], 1, length, file ) == (size_t)length;
+    }
+    fclose( file );
+  }
+
+  if ( !rc )
+    printf( "couldn't read the checkpoint in %s\n", file_name );
+
+  return rc;
+}
+
+
+////////////////////////////////////////////////////////////////////
+// trace routines
+
+// traces come from other tools, so they use Dinero's labels and byte addresses. a byte address is turned
+// into one of our word addresses (wrapping around the 16-bit address space) and then goes through the
+// TLB and cache exactly like a program's loads and stores
+
+
+// runs a single reference from a trace through the first core's cache
+void trace_reference( int label, unsigned long address )
+{
+  core->state.MAR = (unsigned short)(address / WORD_SIZE);
+
+  // 0 is a read and 1 is a write, everything else (instruction fetches, escapes and flushes) isn't ours
+  if ( label != 0 && label != 1 )
+    trace_ignored++;
+
+  else if ( !map_address() )
+    trace_outside++;
+
+  else if ( label == 0 )
+  {
+    load_data( &core->cache, core->state.MAR );
+    trace_reads++;
+  }
+
+  // a trace doesn't have the data that was written, which doesn't matter since we don't report memory for one
+  else
+  {
+    store_data( &core->cache, core->state.MAR, 0 );
+    trace_writes++;
+  }
+}
+
+
+// runs the text lines in the passed part of a trace, "label address" with the address in hex.
+// a line that runs off the end is left for the next part unless this is the last one.
+// returns the number of bytes used, or -1 if a line couldn't be read
+long trace_text( char *text, long length, bool last )
+{
+  long used = 0;
+  char *line;
+  char *end;
+  char *next;
+  long label;
+  unsigned long address;
+
+  while ( used < length )
+  {
+    line = text + used;
+    end = (char *)memchr( line, '\n', length - used );
+    if ( end == NULL && !last )
+      break;
+    if ( end == NULL )
+      end = text + length;
+    *end = '\0';
+
+    label = strtol( line, &next, 10 );
+
+    // blank lines are fine, anything else has to have both fields
+    if ( next != line )
+    {
+      address = strtoul( next, &line, 16 );
+      if ( line == next )
+        return -1;
+      trace_reference( label, address );
+    }
+    else if ( strspn( line, " \t\r" ) != strlen( line ) )
+      return -1;
+
+    used = end - text + 1;
+  }
+
+  return min( used, length );
+}
+
+
+// runs the whole binary records in the passed part of a trace
+// returns the number of bytes used
+long trace_records( unsigned char *records, long length )
+{
+  long used;
+  unsigned char *record;
+
+  for ( used=0 ; used+TRACE_RECORD<=length ; used+=TRACE_RECORD )
+  {
+    record = records + used;
+    trace_reference( record[0], record[1] | record[2] << 8 | record[3] << 16 | (unsigned long)record[4] << 24 );
+  }
+
+  return used;
+}
+
+
+// streams the trace through the first core's cache a buffer at a time, so a trace of any length
+// only needs TRACE_BUFFER bytes
+// returns false if the trace couldn't be read
+bool run_trace()
+{
+  bool rc = true;
+  static char buffer[TRACE_BUFFER+1];
+  long length = 0;   // bytes in the buffer
+  long used;
+  size_t count;
+  bool last = false;
+  FILE *file = strcmp( trace_file, "-" ) == 0 ? stdin : fopen( trace_file, trace_binary ? "rb" : "r" );
+
+  if ( file == NULL )
+  {
+    printf( "couldn't open the trace %s\n", trace_file );
+    rc = false;
+  }
+
+  core = cores;
+  trace_reads = 0;
+  trace_writes = 0;
+  trace_ignored = 0;
+  trace_outside = 0;
+
+  while ( rc && !last )
+  {
+    count = fread( buffer + length, 1, TRACE_BUFFER - length, file );
+    length += count;
+    last = count == 0;
+
+    if ( trace_binary )
+      used = trace_records( (unsigned char *)buffer, length );
+    else
+      used = trace_text( buffer, length, last );
+
+    // a full buffer we can't use any of is a line that's too long
+    if ( used < 0 || (used == 0 && length == TRACE_BUFFER) )
+    {
+      printf( "couldn't read the trace %s\n", trace_file );
+      rc = false;
+    }
+    else
+    {
+      // keep the part we couldn't use yet for the next time around
+      memmove( buffer, buffer + used, length - used );
+      length -= used;
+    }
+  }
+
+  if ( rc && length > 0 )
+    printf( "ignored %ld bytes at the end of the trace\n", length );
+
+  if ( file != NULL && file != stdin )
+    fclose( file );
+
+  return rc;
+}
+
+
+// reports what was in the trace
+void print_trace_statistics()
+{
+  printf( "Trace report for %s:\n", trace_file );
+  printf( "Reads: %lu\nWrites: %lu\nOther references ignored: %lu\nReferences outside data memory: %lu\n\n",
+         trace_reads, trace_writes, trace_ignored, trace_outside );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// layout routines
+
+// the layout advisor watches the data addresses a program uses and proposes moving its words around so the
+// words used together share cache blocks, which means fewer blocks to miss on. the new layout is written as
+// a .dat file with the words in their new places and a .map file of where each word went, and running the
+// program on the new .dat with --remap <file.map> moves each address it uses to match.
+
+
+// counts the misses the recorded references would have in an LRU cache of the configured size, with the
+// addresses moved by the passed layout (or where they were if it's empty).
+// this is the same tag-only model as the shadow cache, which misses exactly when the real cache does with LRU
+int layout_misses( const vector<unsigned short> &layout )
+{
+  struct CACHE model;
+  int misses = 0;
+  size_t i;
+  unsigned short address;
+
+  model.shadow_tags.assign( cache_blocks, 0 );
+  initialize_recency( &model.shadow_recency, cache_blocks );
+  model.shadow_used = 0;
+  model.shadow_slots.assign( MAX_DATA_SIZE / block_size, -1 );
+
+  for ( i=0 ; i<layout_references.size() ; i++ )
+  {
+    address = layout_references[i];
+    if ( !layout.empty() && address < layout.size() )
+      address = layout[address];
+    if ( !touch_shadow( &model, address >> block_offset ) )
+      misses++;
+  }
+
+  return misses;
+}
+
+
+// finds a union-find group's representative, flattening the path as it goes
+int find_group( vector<int> &groups, int word )
+{
+  while ( groups[word] != word )
+  {
+    groups[word] = groups[groups[word]];
+    word = groups[word];
+  }
+
+  return word;
+}
+
+
+// proposes a layout from the recorded references, the new address for every word of data memory.
+// words are grouped greedily, the pairs used together most often first, as long as a group fits in a
+// block. the groups then go into blocks hottest first, and the words that were never used fill in
+// whatever is left over in their original order
+void propose_layout( vector<unsigned short> &layout )
+{
+  unordered_map<unsigned int, int> together;   // how often each pair of words was used together, by a<<16|b
+  vector<pair<int, unsigned int> > pairs;
+  vector<int> groups( data_size );
+  vector<int> sizes( data_size, 1 );
+  vector<int> heat( data_size, 0 );
+  vector<pair<int, int> > order;              // each group's heat and representative, to sort them
+  vector<vector<int> > members( data_size );
+  vector<bool> placed( data_size, false );
+  unordered_map<unsigned int, int>::iterator it;
+  size_t i;
+  size_t j;
+  int a;
+  int b;
+  int next = 0;   // the next free address
+  int placed_words = 0;
+  int used_words = 0;
+  int word;
+
+  for ( i=0 ; i<layout_references.size() ; i++ )
+  {
+    a = layout_references[i];
+    if ( a >= data_size )
+      continue;
+    heat[a]++;
+
+    for ( j=1 ; j<=LAYOUT_WINDOW && j<=i ; j++ )
+    {
+      b = layout_references[i-j];
+      if ( b != a && b < data_size )
+        together[(unsigned int)min( a, b ) << 16 | max( a, b )]++;
+    }
+  }
+
+  for ( it=together.begin() ; it!=together.end() ; it++ )
+    pairs.push_back( make_pair( -it->second, it->first ) );
+  sort( pairs.begin(), pairs.end() );
+
+  for ( a=0 ; a<data_size ; a++ )
+    groups[a] = a;
+  for ( i=0 ; i<pairs.size() ; i++ )
+  {
+    a = find_group( groups, pairs[i].second >> 16 );
+    b = find_group( groups, pairs[i].second & 0xFFFF );
+    if ( a != b && sizes[a] + sizes[b] <= block_size )
+    {
+      groups[b] = a;
+      sizes[a] += sizes[b];
+    }
+  }
+
+  // gather the groups of words that were used, with their heat
+  for ( a=0 ; a<data_size ; a++ )
+  {
+    if ( heat[a] > 0 )
+      members[find_group( groups, a )].push_back( a );
+  }
+  for ( a=0 ; a<data_size ; a++ )
+  {
+    if ( !members[a].empty() )
+    {
+      b = 0;
+      for ( i=0 ; i<members[a].size() ; i++ )
+        b += heat[members[a][i]];
+      order.push_back( make_pair( -b, a ) );
+    }
+  }
+  sort( order.begin(), order.end() );
+
+  // a group that doesn't fit in what's left of a block starts the next one, as long as skipping
+  // the rest of the block still leaves room for every used word that isn't placed yet. the words
+  // nobody used don't need the room, they fill in the skipped gaps
+  for ( a=0 ; a<data_size ; a++ )
+  {
+    if ( heat[a] > 0 )
+      used_words++;
+  }
+  layout.assign( data_size, 0 );
+  for ( i=0 ; i<order.size() ; i++ )
+  {
+    a = order[i].second;
+    b = block_size - next % block_size;
+    if ( (int)members[a].size() > b && next + b + used_words - placed_words <= data_size )
+      next += b;
+    for ( j=0 ; j<members[a].size() ; j++ )
+    {
+      layout[members[a][j]] = next++;
+      placed[members[a][j]] = true;
+      placed_words++;
+    }
+  }
+
+  // the gaps left behind are for the words nobody used
+  vector<bool> taken( data_size, false );
+  for ( a=0 ; a<data_size ; a++ )
+  {
+    if ( placed[a] )
+      taken[layout[a]] = true;
+  }
+  word = 0;
+  for ( a=0 ; a<data_size ; a++ )
+  {
+    if ( !placed[a] )
+    {
+      while ( taken[word] )
+        word++;
+      layout[a] = word;
+      taken[word] = true;
+    }
+  }
+}
+
+
+// reads the words of a .dat file, as many as data memory holds. words the file doesn't have read as filler
+bool read_image( const char *file_name, vector<unsigned short> &image )
+{
+  std::ifstream image_file( file_name );
+  string line;
+  int address = 0;
+  size_t i;
+  unsigned int word;
+
+  image.assign( data_size, (MEM_FILLER << 8) | MEM_FILLER );
+
+  while ( getline( image_file, line ) )
+  {
+    for ( i=0 ; i+4<=line.length() && address<data_size ; i+=4 )
+    {
+      if ( sscanf( line.substr( i, 4 ).c_str(), "%04x", &word ) == 1 )
+        image[address++] = word;
+    }
+  }
+
+  return image_file.eof();
+}
+
+
+// writes out the proposed layout, the data image with every word moved to its new address
+// (in the same format as the original) and the map of where each word went
+bool write_layout( const char *data_filename, const vector<unsigned short> &layout )
+{
+  vector<unsigned short> image;
+  vector<unsigned short> moved;
+  string name;
+  FILE *file;
+  bool rc = read_image( data_filename, image );
+  int i;
+
+  if ( !rc )
+    printf( "couldn't read %s\n", data_filename );
+
+  if ( rc )
+  {
+    moved.assign( data_size, 0 );
+    for ( i=0 ; i<data_size ; i++ )
+      moved[layout[i]] = image[i];
+
+    name = string( layout_prefix ) + ".dat";
+    file = fopen( name.c_str(), "w" );
+    rc = file != NULL;
+    for ( i=0 ; i<data_size && rc ; i++ )
+      fprintf( file, (i % 8 == 7 || i == data_size-1) ? "%04X\n" : "%04X", moved[i] );
+    if ( file != NULL )
+      fclose( file );
+  }
+
+  if ( rc )
+  {
+    name = string( layout_prefix ) + ".map";
+    file = fopen( name.c_str(), "w" );
+    rc = file != NULL;
+    for ( i=0 ; i<data_size && rc ; i++ )
+      fprintf( file, "%04x %04x\n", i, layout[i] );
+    if ( file != NULL )
+      fclose( file );
+  }
+
+  if ( !rc )
+    printf( "couldn't write the layout to %s.dat and %s.map\n", layout_prefix, layout_prefix );
+
+  return rc;
+}
+
+
+// reads a map written by write_layout(), returns false if it isn't one
+bool read_remap( const char *file_name )
+{
+  FILE *file = fopen( file_name, "r" );
+  unsigned int from;
+  unsigned int to;
+  bool rc = file != NULL;
+
+  remap.clear();
+  while ( rc && fscanf( file, "%x %x", &from, &to ) == 2 )
+  {
+    rc = from == remap.size() && to < MAX_DATA_SIZE;
+    remap.push_back( to );
+  }
+  if ( file != NULL )
+    fclose( file );
+
+  if ( !rc || remap.empty() )
+  {
+    printf( "%s isn't a layout map\n", file_name );
+    rc = false;
+  }
+
+  return rc;
+}
+
+
+// proposes a layout from what the program just did, says what it should save and writes it out
+void advise_layout( const char *data_filename )
+{
+  vector<unsigned short> layout;
+  int before;
+  int after;
+
+  propose_layout( layout );
+  before = layout_misses( vector<unsigned short>() );
+  after = layout_misses( layout );
+
+  printf( "Layout report for %d block(s) of %d word(s), %lu data references:\n",
+         cache_blocks, block_size, (unsigned long)layout_references.size() );
+  printf( "LRU misses with the current layout: %d\nLRU misses with the proposed layout: %d\n", before, after );
+  if ( after >= before )
+    printf( "The current layout is as good, nothing written\n\n" );
+  else if ( write_layout( data_filename, layout ) )
+    printf( "Proposed layout written to %s.dat and %s.map\n\n", layout_prefix, layout_prefix );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// decoupled cache routines
+
+// with --decouple the interpreter runs on main memory like the fast functional mode, but every access goes
+// into a queue for the cache, which catches up on its own host thread. the cache sees exactly the accesses
+// it would have, in the same order, so it ends up with the same statistics
+
+
+// returns the tail of the cache model that's furthest behind, the queue is only free up to there
+size_t oldest_tail()
+{
+  size_t head = ring.head.load( memory_order_relaxed );
+  size_t oldest = ring.tails[0].load( memory_order_acquire );
+  size_t tail;
+  int i;
+
+  for ( i=1 ; i<ring.models ; i++ )
+  {
+    tail = ring.tails[i].load( memory_order_acquire );
+    if ( head - tail > head - oldest )
+      oldest = tail;
+  }
+
+  return oldest;
+}
+
+
+// queues an access for the caches, waiting for room if one of them has fallen a whole queue behind
+void queue_access( unsigned short address, bool write )
+{
+  size_t head = ring.head.load( memory_order_relaxed );
+  struct ACCESS *access;
+
+  while ( head - ring_tail > ring.mask )
+  {
+    ring_tail = oldest_tail();
+    if ( head - ring_tail > ring.mask )
+      this_thread::yield();
+  }
+
+  access = &ring.records[head & ring.mask];
+  access->address = address;
+  access->pc = core->state.PC;
+  access->write = write;
+  ring.head.store( head + 1, memory_order_release );
+}
+
+
+// the interpreter's memory accesses, straight to main memory with the access queued for the cache
+unsigned short decoupled_load( struct CACHE *, unsigned short address )
+{
+  unsigned char *word = data_word( address, false );
+
+  queue_access( address, false );
+  return (word[0] << 8) | word[1];
+}
+
+
+void decoupled_store( struct CACHE *, unsigned short address, unsigned short memory_data )
+{
+  unsigned char *word = data_word( address, true );
+
+  queue_access( address, true );
+  word[0] = memory_data >> 8;
+  word[1] = memory_data & 0x00FF;
+}
+
+
+// runs the queued accesses through the passed core's cache, with the passed geometry, until the interpreter
+// has stopped and the queue is empty. this is what each cache model's host thread does, model is its tail
+void drain_accesses( struct CORE *the_core, int model, struct GEOMETRY geometry )
+{
+  size_t tail = ring.tails[model].load( memory_order_relaxed );
+  size_t head;
+  struct ACCESS *access;
+  struct PROFILE *counts;
+  int hits;
+  int misses;
+
+  core = the_core;
+  use_geometry( &geometry );
+
+  while ( true )
+  {
+    head = ring.head.load( memory_order_acquire );
+    if ( head == tail )
+    {
+      // the interpreter may have queued more just before it finished
+      if ( ring.finished.load( memory_order_acquire ) && ring.head.load( memory_order_acquire ) == tail )
+        break;
+      this_thread::yield();
+      continue;
+    }
+
+    for ( ; tail!=head ; tail++ )
+    {
+      access = &ring.records[tail & ring.mask];
+      hits = core->cache.hits;
+      misses = core->cache.misses;
+
+      // the data doesn't matter, the cache doesn't keep it
+      if ( access->write )
+        store_data( &core->cache, access->address, 0 );
+      else
+        load_data( &core->cache, access->address );
+
+      if ( !core->profile.empty() )
+      {
+        counts = &core->profile[access->pc];
+        counts->hits += core->cache.hits - hits;
+        counts->misses += core->cache.misses - misses;
+      }
+    }
+    ring.tails[model].store( tail, memory_order_release );
+  }
+}
+
+
+// sets up the cores that hold the caches of the models --decouple-model adds, each with its own geometry
+void initialize_models()
+{
+  struct GEOMETRY configured;
+  int i;
+
+  get_geometry( &configured );
+  for ( i=0 ; i<(int)decouple_models.size() ; i++ )
+  {
+    cache_blocks = decouple_models[i].blocks;
+    block_size = decouple_models[i].words;
+    block_offset = log2_of( block_size );
+    select_cache_model();
+    get_geometry( &decouple_models[i] );
+
+    // only the configured cache is profiled
+    initialize_core( &model_cores[i], 0 );
+    model_cores[i].profile.clear();
+  }
+  use_geometry( &configured );
+}
+
+
+// runs the only core with its cache, and the caches of any other models, decoupled onto host threads
+// of their own
+void run_decoupled( struct CORE *the_core )
+{
+  vector<thread> cache_threads;
+  struct GEOMETRY configured;
+  int models = 1 + decouple_models.size();
+  int i;
+
+  ring.records.resize( decouple_records );
+  ring.mask = decouple_records - 1;
+  ring.head.store( 0 );
+  for ( i=0 ; i<models ; i++ )
+    ring.tails[i].store( 0 );
+  ring.models = models;
+  ring.finished.store( false );
+  ring_tail = 0;
+
+  initialize_models();
+  get_geometry( &configured );
+  load_data = decoupled_load;
+  store_data = decoupled_store;
+  decoupled = true;
+
+  cache_threads.push_back( thread( drain_accesses, the_core, 0, configured ) );
+  for ( i=1 ; i<models ; i++ )
+    cache_threads.push_back( thread( drain_accesses, &model_cores[i-1], i, decouple_models[i-1] ) );
+  run_core( the_core );
+  ring.finished.store( true, memory_order_release );
+  for ( i=0 ; i<models ; i++ )
+    cache_threads[i].join();
+
+  // the caches' (dirty) blocks are only tags, main memory already has everything
+  for ( i=1 ; i<models ; i++ )
+  {
+    use_geometry( &decouple_models[i-1] );
+    cache_flush( &model_cores[i-1].cache );
+  }
+  use_geometry( &configured );
+  cache_flush( &the_core->cache );
+  decoupled = false;
+}
+
+
+// prints the report of each model --decouple-model added, under its own geometry
+void print_models()
+{
+  struct GEOMETRY configured;
+  int i;
+
+  get_geometry( &configured );
+  for ( i=0 ; i<(int)decouple_models.size() ; i++ )
+  {
+    use_geometry( &decouple_models[i] );
+    printf( "Model %d:\n", i+1 );
+    print_statistics( &model_cores[i].cache );
+  }
+  use_geometry( &configured );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// profiling routines
+
+// the profiler counts the executions, cache hits and misses and taken branches of each instruction address.
+// the assembler writes a line map next to the object file, the source line and label for each address,
+// which turns the counts into an annotated listing of the source and a list of its hottest lines
+
+
+// counts the instruction that's just been written back against its address
+void profile_instruction()
+{
+  struct PROFILE *counts = &core->profile[core->profile_pc];
+
+  counts->executions++;
+  if ( !decoupled )
+  {
+    counts->hits += core->cache.hits - core->profile_hits;
+    counts->misses += core->cache.misses - core->profile_misses;
+  }
+
+  // a jump is always taken, a branch moved the PC if it was
+  if ( opcode() == BRANCH_OPCODE && (mode() == 0 || core->state.PC != core->profile_pc) )
+    counts->taken++;
+}
+
+
+// prints the source with every line's counts, summed over the cores, and then the hottest lines by misses
+void print_profile()
+{
+  std::ifstream source_file( profile_source );
+  string map_name( profile_source );
+  FILE *map_file;
+  vector<string> source;
+  vector<struct PROFILE> lines;
+  vector<string> labels;
+  vector<bool> executable;
+  vector<pair<pair<unsigned long, unsigned long>, int> > hot;   // each line's misses and executions, to sort them
+  struct PROFILE none = { 0, 0, 0, 0 };
+  string text;
+  unsigned long misses = 0;
+  unsigned int address;
+  int line;
+  char label[32];
+  int i;
+
+  while ( getline( source_file, text ) )
+    source.push_back( text );
+
+  map_name = map_name.substr( 0, map_name.rfind( '.' ) ) + ".lines";
+  map_file = fopen( map_name.c_str(), "r" );
+  if ( source.empty() || map_file == NULL )
+  {
+    printf( "couldn't read %s and its line map %s\n\n", profile_source, map_name.c_str() );
+    if ( map_file != NULL )
+      fclose( map_file );
+    return;
+  }
+
+  lines.assign( source.size() + 1, none );
+  labels.assign( source.size() + 1, "-" );
+  executable.assign( source.size() + 1, false );
+  while ( fscanf( map_file, "%x %d %31s", &address, &line, label ) == 3 )
+  {
+    if ( address >= CODE_SIZE || line < 1 || line > (int)source.size() )
+      continue;
+
+    executable[line] = true;
+    labels[line] = label;
+    for ( i=0 ; i<num_cores ; i++ )
+    {
+      lines[line].executions += cores[i].profile[address].executions;
+      lines[line].hits += cores[i].profile[address].hits;
+      lines[line].misses += cores[i].profile[address].misses;
+      lines[line].taken += cores[i].profile[address].taken;
+    }
+  }
+  fclose( map_file );
+
+  printf( "Profile of %s:\n", profile_source );
+  printf( "  line  executed      hits    misses     taken  source\n" );
+  for ( line=1 ; line<=(int)source.size() ; line++ )
+  {
+    if ( executable[line] )
+    {
+      printf( "%6d %9lu %9lu %9lu %9lu  %s\n", line, lines[line].executions, lines[line].hits,
+             lines[line].misses, lines[line].taken, source[line-1].c_str() );
+      misses += lines[line].misses;
+      if ( lines[line].executions > 0 )
+        hot.push_back( make_pair( make_pair( lines[line].misses, lines[line].executions ), line ) );
+    }
+    else
+      printf( "%6d %39s  %s\n", line, "", source[line-1].c_str() );
+  }
+
+  sort( hot.rbegin(), hot.rend() );
+  printf( "\nHot spots by misses:\n" );
+  printf( "  line  label                      executed    misses  of misses\n" );
+  for ( i=0 ; i<(int)hot.size() && i<PROFILE_HOT_SPOTS ; i++ )
+  {
+    line = hot[i].second;
+    printf( "%6d  %-24s %9lu %9lu  %8.2f%%\n", line, labels[line].c_str(), lines[line].executions,
+           lines[line].misses, misses > 0 ? 100.0 * lines[line].misses / misses : 0.0 );
+  }
+  printf( "\n" );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// timing routines
+
+// the cache itself still fills a block the moment it misses, the timing follows along afterwards working out
+// when each instruction could have issued with the misses taking miss_cycles and overlapping each other
+// as far as the MSHRs allow
+
+
+// returns the cycle the passed block's data is ready for an access at the current cycle, taking an MSHR
+// for a miss. a miss on a block that's already in flight merges with it instead
+unsigned long time_access( struct TIMING *timing, unsigned short tag, bool missed )
+{
+  unsigned long ready = timing->cycle;
+  size_t i;
+  size_t earliest;
+  struct MSHR mshr;
+
+  // the blocks that have arrived give their MSHRs back
+  for ( i=0 ; i<timing->mshrs.size() ; )
+  {
+    if ( timing->mshrs[i].ready <= timing->cycle )
+    {
+      timing->mshrs[i] = timing->mshrs.back();
+      timing->mshrs.pop_back();
+    }
+    else
+      i++;
+  }
+
+  for ( i=0 ; i<timing->mshrs.size() ; i++ )
+  {
+    if ( timing->mshrs[i].tag == tag )
+    {
+      timing->merged_misses++;
+      return timing->mshrs[i].ready;
+    }
+  }
+
+  if ( missed )
+  {
+    // with every MSHR busy the miss can't even start until one is free
+    if ( (int)timing->mshrs.size() == mshr_count )
+    {
+      earliest = 0;
+      for ( i=1 ; i<timing->mshrs.size() ; i++ )
+      {
+        if ( timing->mshrs[i].ready < timing->mshrs[earliest].ready )
+          earliest = i;
+      }
+      timing->mshr_stalls += timing->mshrs[earliest].ready - timing->cycle;
+      timing->cycle = timing->mshrs[earliest].ready;
+      timing->mshrs[earliest] = timing->mshrs.back();
+      timing->mshrs.pop_back();
+    }
+
+    ready = timing->cycle + miss_cycles;
+    mshr.tag = tag;
+    mshr.ready = ready;
+    timing->mshrs.push_back( mshr );
+    timing->primary_misses++;
+    timing->peak = max( timing->peak, (int)timing->mshrs.size() );
+  }
+
+  return ready;
+}
+
+
+// times the instruction that's just been written back, from the registers it read and the memory it used
+void time_instruction()
+{
+  struct TIMING *timing = &core->timing;
+  unsigned char reg1 = get_reg1();
+  unsigned char reg2 = (core->state.IR[1] >> 2) & 0x0F;
+  unsigned long start = timing->cycle;
+  int misses = core->cache.misses - timing->misses;
+  int slow = misses - (core->cache.victim_hits - timing->victim_hits);   // misses that went to main memory
+  bool writes_reg1 = false;
+  unsigned long ready;
+
+  // wait for the registers the instruction reads
+  switch( opcode() )
+  {
+    case ADD_OPCODE:
+    case SUB_OPCODE:
+    case AND_OPCODE:
+    case OR_OPCODE:
+    case XOR_OPCODE:
+      start = max( start, timing->ready[reg1] );
+      if ( mode() & 0x01 )
+        start = max( start, timing->ready[reg2] );
+      writes_reg1 = true;
+      break;
+
+    case SHIFT_OPCODE:
+      start = max( start, timing->ready[reg1] );
+      writes_reg1 = true;
+      break;
+
+    case BRANCH_OPCODE:
+      start = max( start, timing->ready[reg1] );
+      if ( mode() != 0 )
+        start = max( start, timing->ready[0] );
+      break;
+
+    // a store only needs its address, the value waits in a store buffer if it isn't ready yet
+    case MOVE_OPCODE:
+      if ( mode() & 0x04 )
+        start = max( start, timing->ready[reg1] );
+      else
+        writes_reg1 = true;
+      if ( (mode() & 0x05) == 0x01 || mode() == BLOCK_MOVE_MODE )
+        start = max( start, timing->ready[reg2] );
+      if ( mode() == BLOCK_MOVE_MODE )
+        start = max( start, timing->ready[0] );
+      break;
+
+    default:
+      break;
+  }
+  timing->load_stalls += start - timing->cycle;
+  timing->cycle = start;
+
+  // a block move waits for its whole copy, everything else has at most one access
+  if ( opcode() == MOVE_OPCODE && mode() == BLOCK_MOVE_MODE )
+    timing->cycle += slow * miss_cycles;
+
+  else if ( opcode() == MOVE_OPCODE && (mode() & 0x05) != 0 )
+  {
+    ready = time_access( timing, core->state.MAR >> block_offset, slow > 0 );
+
+    // a load's register is ready when the data is, a store goes into the block whenever it arrives
+    if ( !(mode() & 0x04) )
+    {
+      timing->ready[reg1] = ready;
+      writes_reg1 = false;
+    }
+  }
+
+  timing->cycle++;
+  if ( writes_reg1 )
+    timing->ready[reg1] = timing->cycle;
+}
+
+
+// reports how long the core took with the non-blocking cache, next to what a blocking one would have taken
+void print_timing( struct CORE *the_core )
+{
+  struct TIMING *timing = &the_core->timing;
+  unsigned long blocking = the_core->instructions +
+                           (unsigned long)(the_core->cache.misses - the_core->cache.victim_hits) * miss_cycles;
+
+  printf( "Non-blocking cache with %d MSHR(s) and %d cycle misses:\n", mshr_count, miss_cycles );
+  printf( "Cycles: %lu (%lu with a blocking cache)\n", timing->cycle, blocking );
+  printf( "Stall cycles waiting for loads: %lu\nStall cycles waiting for an MSHR: %lu\n",
+         timing->load_stalls, timing->mshr_stalls );
+  printf( "Primary misses: %lu\nMerged misses: %lu\n", timing->primary_misses, timing->merged_misses );
+  printf( "MSHR occupancy: %.2f average, %d peak\n\n",
+         timing->cycle > 0 ? (double)timing->primary_misses * miss_cycles / timing->cycle : 0.0, timing->peak );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// telemetry routines
+
+// telemetry writes a CSV line for each core every telemetry_window instructions (or accesses): the hits,
+// misses and write-backs in the window, the blocks it used (its working set) and how many blocks the
+// cache holds at the end of it. phases go by the code that ran rather than the data it used, since a loop
+// streaming through an array is one phase however many blocks it goes through. a window that shares less
+// than half its instruction addresses with the one before (counting the ones either ran) starts a new phase
+
+
+// closes the telemetry file without writing anything more, for a run that stopped before its reports
+void close_telemetry()
+{
+  if ( telemetry == NULL )
+    return;
+
+  fclose( telemetry );
+  telemetry = NULL;
+}
+
+
+// starts the telemetry file, if we're keeping one. a file an earlier run left open is closed first
+void start_telemetry()
+{
+  close_telemetry();
+  if ( telemetry_file == NULL )
+    return;
+
+  telemetry = fopen( telemetry_file, "w" );
+  if ( telemetry == NULL )
+    printf( "couldn't write the telemetry to %s\n", telemetry_file );
+  else
+    fprintf( telemetry, "core,window,instructions,accesses,hits,misses,hit_rate,writebacks,working_set,"
+                        "valid_blocks,similarity,phase\n" );
+}
+
+
+// counts a block the current window used
+void use_block( unsigned short tag )
+{
+  struct TELEMETRY *window = &core->telemetry;
+
+  if ( window->used[tag] != window->window )
+  {
+    window->used[tag] = window->window;
+    window->working_set++;
+  }
+}
+
+
+// counts an instruction address the current window ran
+void run_address( unsigned short pc )
+{
+  struct TELEMETRY *window = &core->telemetry;
+
+  if ( window->executed[pc] != window->window )
+  {
+    if ( window->window > 0 && window->executed[pc] == window->window - 1 )
+      window->common_code++;
+    window->executed[pc] = window->window;
+    window->code_set++;
+  }
+}
+
+
+// writes out the passed core's current window and starts the next one
+void end_window( struct CORE *the_core )
+{
+  struct TELEMETRY *window = &the_core->telemetry;
+  struct PHASE phase;
+  int hits = the_core->cache.hits - window->hits;
+  int misses = the_core->cache.misses - window->misses;
+  int either = window->code_set + window->previous_code - window->common_code;
+  double similarity = either > 0 ? (double)window->common_code / either : 1.0;
+
+  if ( window->phases.empty() || similarity < PHASE_SIMILARITY )
+  {
+    phase.first_window = window->window;
+    phase.windows = 0;
+    phase.instructions = 0;
+    phase.hits = 0;
+    phase.misses = 0;
+    window->phases.push_back( phase );
+  }
+  window->phases.back().windows++;
+  window->phases.back().instructions += the_core->instructions - window->instructions;
+  window->phases.back().hits += hits;
+  window->phases.back().misses += misses;
+
+  fprintf( telemetry, "%d,%d,%lu,%d,%d,%d,%.4f,%d,%d,%d,%.4f,%d\n", the_core->id, window->window,
+          the_core->instructions, hits + misses, hits, misses, hits + misses > 0 ? (double)hits / (hits + misses) : 0.0,
+          the_core->cache.writebacks - window->writebacks, window->working_set, the_core->cache.valid_blocks,
+          similarity, (int)window->phases.size() );
+
+  window->window++;
+  window->instructions = the_core->instructions;
+  window->hits = the_core->cache.hits;
+  window->misses = the_core->cache.misses;
+  window->writebacks = the_core->cache.writebacks;
+  window->working_set = 0;
+  window->previous_code = window->code_set;
+  window->code_set = 0;
+  window->common_code = 0;
+}
+
+
+// ends the current core's window if it's full
+void check_window()
+{
+  struct TELEMETRY *window = &core->telemetry;
+
+  if ( window_by_accesses ?
+       core->cache.hits + core->cache.misses - window->hits - window->misses >= telemetry_window :
+       core->instructions - window->instructions >= (unsigned long)telemetry_window )
+    end_window( core );
+}
+
+
+// writes out what's left of every core's last window, closes the file and lists each core's phases
+void finish_telemetry()
+{
+  struct PHASE *phase;
+  int i;
+  size_t j;
+
+  for ( i=0 ; i<num_cores ; i++ )
+  {
+    if ( cores[i].instructions > cores[i].telemetry.instructions )
+      end_window( &cores[i] );
+  }
+  close_telemetry();
+
+  printf( "Telemetry written to %s, %d %s a window\n", telemetry_file, telemetry_window,
+         window_by_accesses ? "accesses" : "instructions" );
+  for ( i=0 ; i<num_cores ; i++ )
+  {
+    if ( num_cores > 1 )
+      printf( "Core %d ", i );
+    printf( "Phases: %d\n", (int)cores[i].telemetry.phases.size() );
+    for ( j=0 ; j<cores[i].telemetry.phases.size() ; j++ )
+    {
+      phase = &cores[i].telemetry.phases[j];
+      printf( "  phase %d: windows %d-%d, %lu instructions, %d misses, hit rate %.2f%%\n", (int)j + 1,
+             phase->first_window, phase->first_window + phase->windows - 1, phase->instructions, phase->misses,
+             phase->hits + phase->misses > 0 ? 100.0 * phase->hits / (phase->hits + phase->misses) : 0.0 );
+    }
+  }
+  printf( "\n" );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// scratchpad routines
+
+// the scratchpad is a small memory of its own, managed by the program rather than the hardware. the data the
+// assembler's .scratchpad directives asked for is copied into it when the program is loaded, and every access
+// to one of those words goes to it at a fixed cost instead of through the cache. the rest of the data goes
+// through the cache as usual
+
+
+// reads the regions that go in the scratchpad from a .pad file, a line of "first words" for each with the
+// first word address in hex. returns false (after saying why) if they don't fit
+bool read_scratchpad( const char *file_name )
+{
+  std::ifstream file( file_name );
+  string line;
+  unsigned int first;
+  int words;
+  int i;
+
+  if ( !file.is_open() )
+  {
+    printf( "couldn't read the scratchpad regions in %s\n", file_name );
+    return false;
+  }
+
+  in_scratchpad.assign( MAX_DATA_SIZE, false );
+  scratchpad.assign( MAX_DATA_SIZE * WORD_SIZE, MEM_FILLER );
+  scratchpad_words = 0;
+  scratchpad_regions = 0;
+  while ( getline( file, line ) )
+  {
+    if ( sscanf( line.c_str(), "%x %d", &first, &words ) != 2 )
+      continue;
+    if ( words < 1 || first + words > (unsigned int)data_size )
+    {
+      printf( "the scratchpad region at %04x of %d words isn't in data memory\n", first, words );
+      return false;
+    }
+
+    for ( i=0 ; i<words ; i++ )
+    {
+      if ( !in_scratchpad[first + i] )
+        scratchpad_words++;
+      in_scratchpad[first + i] = true;
+    }
+    scratchpad_regions++;
+  }
+
+  if ( scratchpad_words > MAX_SCRATCHPAD_WORDS )
+  {
+    printf( "the scratchpad can hold at most %d words, %s asks for %d\n", MAX_SCRATCHPAD_WORDS, file_name,
+            scratchpad_words );
+    return false;
+  }
+
+  return true;
+}
+
+
+// copies the words that go in the scratchpad out of the data memory the program was loaded into
+void fill_scratchpad()
+{
+  int i;
+
+  for ( i=0 ; i<(int)in_scratchpad.size() ; i++ )
+    if ( in_scratchpad[i] )
+      memcpy( &scratchpad[i*WORD_SIZE], data_word( i, false ), WORD_SIZE );
+}
+
+
+// the memory accesses with a scratchpad, its words are read and written there and the rest go to the cache
+unsigned short scratchpad_load( struct CACHE *cache, unsigned short address )
+{
+  unsigned char *word;
+
+  if ( !in_scratchpad[address] )
+    return model_load( cache, address );
+
+  core->scratchpad_accesses++;
+  word = &scratchpad[address*WORD_SIZE];
+  return (word[0] << 8) | word[1];
+}
+
+
+void scratchpad_store( struct CACHE *cache, unsigned short address, unsigned short memory_data )
+{
+  unsigned char *word;
+
+  if ( !in_scratchpad[address] )
+  {
+    model_store( cache, address, memory_data );
+    return;
+  }
+
+  core->scratchpad_accesses++;
+  word = &scratchpad[address*WORD_SIZE];
+  word[0] = memory_data >> 8;
+  word[1] = memory_data & 0x00FF;
+}
+
+
+// prints how the accesses split between the scratchpad and the cache and what they cost
+void print_scratchpad( struct CORE *the_core )
+{
+  unsigned long hits = the_core->cache.hits;
+  unsigned long misses = the_core->cache.misses;
+  unsigned long cycles = the_core->scratchpad_accesses * SCRATCHPAD_CYCLES + hits * HIT_CYCLES + misses * miss_cycles;
+
+  // with the DRAM model the misses cost whatever their fills took
+  if ( dram_banks > 0 )
+    cycles += dram.fill_cycles - misses * miss_cycles;
+
+  printf( "Scratchpad: %d word(s) in %d region(s)\n", scratchpad_words, scratchpad_regions );
+  printf( "Scratchpad accesses: %lu\n", the_core->scratchpad_accesses );
+  printf( "Cache accesses: %lu\n", hits + misses );
+  if ( dram_banks > 0 )
+    printf( "Memory cycles: %lu (%d per scratchpad access, %d per hit, the DRAM's fills for the misses)\n\n", cycles,
+            SCRATCHPAD_CYCLES, HIT_CYCLES );
+  else
+    printf( "Memory cycles: %lu (%d per scratchpad access, %d per hit, %d per miss)\n\n", cycles, SCRATCHPAD_CYCLES,
+            HIT_CYCLES, miss_cycles );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// static analysis routines
+
+// the static analysis works out what the cache does without running the program, for every input it could
+// be given. it follows the code's control flow from the branches, working out the register values it can
+// (and the data, if the .dat is the program's input) so it knows the addresses of most loads and stores.
+// for the cache it keeps two views of an LRU cache at every instruction: must, the blocks that are certainly
+// cached and the oldest each can be, and may, the blocks that could be cached and the youngest each can be.
+// an access to a block that must be cached always hits, one to a block that can't be always misses and the
+// rest could go either way, so each execution of an instruction misses at most as often as it has accesses
+// that aren't always hits.
+
+
+// makes an access to the passed block (or an unknown one, -1) through the passed register (or -1) and says
+// whether it always hits, always misses or could do either
+Verdict access_block( struct ABSTRACT &state, int block, int reg )
+{
+  Verdict verdict = UNKNOWN_ACCESS;
+  map<unsigned short, int>::iterator it;
+  map<unsigned short, int>::iterator next;
+  int age = cache_blocks;    // the must age of the block, cache_blocks if it isn't certainly cached
+  int youngest;              // the may age of the block
+  int i;
+
+  if ( block >= 0 )
+  {
+    it = state.must.find( block );
+    if ( it != state.must.end() )
+    {
+      verdict = ALWAYS_HIT;
+      age = it->second;
+    }
+    else if ( !state.may_any && state.may.find( block ) == state.may.end() )
+      verdict = ALWAYS_MISS;
+
+    // the blocks younger than it get older, and fall out once they're as old as the cache is big
+    for ( it=state.must.begin() ; it!=state.must.end() ; it=next )
+    {
+      next = it;
+      next++;
+      if ( it->first != block && it->second < age && ++it->second >= cache_blocks )
+        state.must.erase( it );
+    }
+    state.must[block] = 0;
+
+    // anything that could be no older than it could get older. if it could be anywhere we can't say
+    // anything got older
+    it = state.may.find( block );
+    youngest = it != state.may.end() ? it->second : state.may_any ? -1 : cache_blocks;
+    for ( it=state.may.begin() ; it!=state.may.end() ; it=next )
+    {
+      next = it;
+      next++;
+      if ( it->first != block && it->second <= youngest && ++it->second >= cache_blocks )
+        state.may.erase( it );
+    }
+    state.may[block] = 0;
+  }
+
+  // a register that still points at a block it's been used for since that block was certainly cached hits it
+  // again, and a hit never throws anything out. we don't know which block it made the youngest though, so
+  // from here on any block could still be cached however old may says it is
+  else if ( reg >= 0 && state.block_ages[reg] >= 0 )
+  {
+    verdict = ALWAYS_HIT;
+    for ( it=state.must.begin() ; it!=state.must.end() ; it++ )
+      it->second = min( it->second + 1, cache_blocks - 1 );
+    state.may_any = true;
+  }
+
+  // any block could have come in, pushing everything else along
+  else
+  {
+    for ( it=state.must.begin() ; it!=state.must.end() ; it=next )
+    {
+      next = it;
+      next++;
+      if ( ++it->second >= cache_blocks )
+        state.must.erase( it );
+    }
+    state.may_any = true;
+  }
+
+  // the blocks the registers point at get older the same way
+  for ( i=0 ; i<REGISTERS ; i++ )
+  {
+    if ( state.block_ages[i] < 0 )
+      continue;
+    if ( verdict == ALWAYS_HIT )
+      state.block_ages[i] = min( state.block_ages[i] + 1, cache_blocks - 1 );
+    else if ( ++state.block_ages[i] >= cache_blocks )
+      state.block_ages[i] = -1;
+  }
+  if ( reg >= 0 )
+    state.block_ages[reg] = 0;
+
+  // once the cache is certainly full we know everything in it
+  if ( (int)state.must.size() == cache_blocks )
+  {
+    state.may.clear();
+    for ( it=state.must.begin() ; it!=state.must.end() ; it++ )
+      state.may[it->first] = 0;
+    state.may_any = false;
+  }
+
+  return verdict;
+}
+
+
+// returns the value of the passed word of data memory, or UNKNOWN_VALUE
+int known_word( const struct ABSTRACT &state, unsigned short address )
+{
+  map<unsigned short, int>::const_iterator it;
+  unsigned char *word;
+
+  if ( state.clobbered )
+    return UNKNOWN_VALUE;
+
+  it = state.stored.find( address );
+  if ( it != state.stored.end() )
+    return it->second;
+
+  if ( analyze_any )
+    return UNKNOWN_VALUE;
+
+  word = data_word( address, false );
+  return (word[0] << 8) | word[1];
+}
+
+
+// stores a value (or UNKNOWN_VALUE) to the passed word of data memory, or to somewhere we don't know (-1)
+void store_word( struct ABSTRACT &state, int address, int value )
+{
+  if ( address < 0 )
+  {
+    state.clobbered = true;
+    state.stored.clear();
+  }
+  else if ( !state.clobbered )
+    state.stored[address] = value;
+}
+
+
+// counts an access towards an instruction's verdict
+void count_access( struct VERDICT *verdict, Verdict kind, int block, int accesses )
+{
+  verdict->accesses += accesses;
+  if ( kind == ALWAYS_HIT )
+    verdict->always_hits += accesses;
+  else if ( kind == ALWAYS_MISS )
+    verdict->always_misses += accesses;
+  else
+    verdict->unknown += accesses;
+  verdict->block = verdict->accesses == 1 ? block : -1;
+}
+
+
+// works out what a block move does, with the same pieces move_block() copies.
+// returns false if it certainly goes outside data memory, which stops the program
+bool analyze_block_move( struct ABSTRACT &state, int destination, int source, struct VERDICT *verdict )
+{
+  int count = state.registers[0];
+  int piece;
+  int accesses;
+  int i;
+  vector<int> words;
+
+  if ( count == 0 )
+    return true;
+
+  // the pieces are only known if everything is
+  if ( count > 0 && destination >= 0 && source >= 0 )
+  {
+    if ( source + count > data_size || destination + count > data_size )
+      return false;
+
+    while ( count > 0 )
+    {
+      piece = min( block_size - (source & (block_size - 1)), block_size - (destination & (block_size - 1)) );
+      piece = min( piece, count );
+
+      count_access( verdict, access_block( state, source >> block_offset, -1 ), source >> block_offset, 1 );
+      count_access( verdict, access_block( state, destination >> block_offset, -1 ), destination >> block_offset, 1 );
+
+      words.clear();
+      for ( i=0 ; i<piece ; i++ )
+        words.push_back( known_word( state, (unsigned short)(source + i) ) );
+      for ( i=0 ; i<piece ; i++ )
+        store_word( state, (unsigned short)(destination + i), words[i] );
+
+      source = (unsigned short)(source + piece);
+      destination = (unsigned short)(destination + piece);
+      count -= piece;
+    }
+  }
+
+  // otherwise every piece is a word at worst, a load and a store each
+  else
+  {
+    accesses = 2 * (count > 0 ? count : 0xFFFF);
+    for ( i=0 ; i<accesses && i<=cache_blocks ; i++ )
+      access_block( state, -1, -1 );
+    count_access( verdict, UNKNOWN_ACCESS, -1, accesses );
+
+    if ( destination >= 0 && count > 0 )
+      for ( i=0 ; i<count ; i++ )
+        store_word( state, (unsigned short)(destination + i), UNKNOWN_VALUE );
+    else
+      store_word( state, -1, UNKNOWN_VALUE );
+  }
+
+  return true;
+}
+
+
+// runs the instruction at the passed address on the passed state, leaving what's known after it.
+// the instructions that can run next go in next, and what it did with the cache in verdict
+void analyze_instruction( unsigned short pc, struct ABSTRACT &state, vector<unsigned short> &next,
+                          struct VERDICT *verdict )
+{
+  unsigned char opcode = code[pc][0] >> 5;
+  unsigned char mode = (code[pc][0] >> 2) & 0x07;
+  unsigned char reg1 = ((code[pc][0] & 0x03) << 2) | (code[pc][1] >> 6);
+  unsigned char reg2 = (code[pc][1] >> 2) & 0x0F;
+  int literal = code[pc][1] & 0x3F;
+  int x = state.registers[reg1];
+  int y;
+  int z = UNKNOWN_VALUE;
+  int address;
+  int target;
+  bool taken = true;
+  bool not_taken = true;
+
+  memset( verdict, 0, sizeof(struct VERDICT) );
+  verdict->block = -1;
+  next.clear();
+
+  // sign extend the literal
+  if ( literal & 0x20 )
+    literal |= 0xFFC0;
+
+  switch( opcode )
+  {
+    case ADD_OPCODE:
+    case SUB_OPCODE:
+    case AND_OPCODE:
+    case OR_OPCODE:
+    case XOR_OPCODE:
+    case SHIFT_OPCODE:
+      if ( opcode == SHIFT_OPCODE ? mode > 1 : !alu_mode( opcode, mode ) )
+        return;
+
+      y = opcode == SHIFT_OPCODE || (mode & 0x01) == 0 ? literal : state.registers[reg2];
+      if ( opcode != SHIFT_OPCODE && (mode & 0x03) == PACKED_MODE )
+        y = (y & 0xFF) * 0x0101;
+      if ( x != UNKNOWN_VALUE && y != UNKNOWN_VALUE && opcode <= XOR_OPCODE && (mode & PACKED_MODE) )
+        z = packed_alu( opcode, mode & SATURATE_MODE, x, y );
+      else if ( x != UNKNOWN_VALUE && y != UNKNOWN_VALUE )
+      {
+        switch( opcode )
+        {
+          case ADD_OPCODE:   z = x + y;  break;
+          case SUB_OPCODE:   z = x - y;  break;
+          case AND_OPCODE:   z = x & y;  break;
+          case OR_OPCODE:    z = x | y;  break;
+          case XOR_OPCODE:   z = x ^ y;  break;
+          default:           z = mode == 0 ? x >> 1 : x << 1;  break;
+        }
+        z &= 0xFFFF;
+      }
+      state.registers[reg1] = z;
+      state.block_ages[reg1] = -1;
+      break;
+
+    case MOVE_OPCODE:
+      if ( mode == BLOCK_MOVE_MODE )
+      {
+        if ( !analyze_block_move( state, x, state.registers[reg2], verdict ) )
+          return;
+      }
+
+      else if ( mode & 0x02 )
+        return;
+
+      // a store, of the literal or the second register
+      else if ( mode & 0x04 )
+      {
+        if ( x >= data_size )
+          return;
+        count_access( verdict, access_block( state, x >= 0 ? x >> block_offset : -1, reg1 ),
+                      x >= 0 ? x >> block_offset : -1, 1 );
+        store_word( state, x, mode & 0x01 ? state.registers[reg2] : literal );
+      }
+
+      // a load
+      else if ( mode & 0x01 )
+      {
+        address = state.registers[reg2];
+        if ( address >= data_size )
+          return;
+        count_access( verdict, access_block( state, address >= 0 ? address >> block_offset : -1, reg2 ),
+                      address >= 0 ? address >> block_offset : -1, 1 );
+        state.registers[reg1] = address >= 0 ? known_word( state, address ) : UNKNOWN_VALUE;
+        state.block_ages[reg1] = -1;
+      }
+
+      else
+      {
+        state.registers[reg1] = literal;
+        state.block_ages[reg1] = -1;
+      }
+      break;
+
+    case BRANCH_OPCODE:
+      if ( mode == 0x07 )
+        return;
+
+      // a jump goes to the instruction after the address in the register
+      if ( mode == 0 )
+      {
+        if ( x == UNKNOWN_VALUE )
+          verdict->unresolved = true;
+        else if ( ((x + 1) & 0xFFFF) < CODE_SIZE )
+          next.push_back( (x + 1) & 0xFFFF );
+        return;
+      }
+
+      // if we know both sides of the comparison only one way is possible
+      if ( x != UNKNOWN_VALUE && state.registers[0] != UNKNOWN_VALUE )
+      {
+        switch( mode )
+        {
+          case 1:  taken = (short)x == (short)state.registers[0];  break;
+          case 2:  taken = (short)x != (short)state.registers[0];  break;
+          case 3:  taken = (short)x < (short)state.registers[0];   break;
+          case 4:  taken = (short)x > (short)state.registers[0];   break;
+          case 5:  taken = (short)x <= (short)state.registers[0];  break;
+          default: taken = (short)x >= (short)state.registers[0];  break;
+        }
+        not_taken = !taken;
+      }
+
+      target = (pc + literal) & 0xFFFF;
+      if ( taken && target < CODE_SIZE )
+        next.push_back( target );
+      if ( not_taken && pc + 1 < CODE_SIZE && target != pc + 1 )
+        next.push_back( pc + 1 );
+      return;
+
+    default:
+      return;
+  }
+
+  if ( pc + 1 < CODE_SIZE )
+    next.push_back( pc + 1 );
+}
+
+
+// merges another way into an instruction into what's known there
+// returns true if that changed anything
+bool join_state( struct ABSTRACT &into, const struct ABSTRACT &from )
+{
+  struct ABSTRACT before;
+  map<unsigned short, int> merged;
+  map<unsigned short, int>::const_iterator it;
+  map<unsigned short, int>::iterator found;
+  int i;
+
+  if ( !into.reached )
+  {
+    into = from;
+    return true;
+  }
+  before = into;
+
+  for ( i=0 ; i<REGISTERS ; i++ )
+  {
+    if ( into.registers[i] != from.registers[i] )
+      into.registers[i] = UNKNOWN_VALUE;
+    if ( into.block_ages[i] < 0 || from.block_ages[i] < 0 )
+      into.block_ages[i] = -1;
+    else
+      into.block_ages[i] = max( into.block_ages[i], from.block_ages[i] );
+  }
+
+  // a word is only known if both ways agree on it
+  if ( into.clobbered || from.clobbered )
+  {
+    into.clobbered = true;
+    into.stored.clear();
+  }
+  else
+  {
+    for ( it=into.stored.begin() ; it!=into.stored.end() ; it++ )
+      merged[it->first] = it->second == known_word( from, it->first ) ? it->second : UNKNOWN_VALUE;
+    for ( it=from.stored.begin() ; it!=from.stored.end() ; it++ )
+      if ( merged.find( it->first ) == merged.end() )
+        merged[it->first] = it->second == known_word( into, it->first ) ? it->second : UNKNOWN_VALUE;
+    into.stored = merged;
+  }
+
+  // a block must be cached if it is both ways, at the older of its ages
+  merged.clear();
+  for ( it=into.must.begin() ; it!=into.must.end() ; it++ )
+  {
+    if ( from.must.find( it->first ) != from.must.end() )
+      merged[it->first] = max( it->second, from.must.find( it->first )->second );
+  }
+  into.must = merged;
+
+  // and may be cached if it may be either way, at the younger
+  for ( it=from.may.begin() ; it!=from.may.end() ; it++ )
+  {
+    found = into.may.find( it->first );
+    if ( found == into.may.end() )
+      into.may[it->first] = it->second;
+    else
+      found->second = min( found->second, it->second );
+  }
+  into.may_any = into.may_any || from.may_any;
+
+  return !(memcmp( before.registers, into.registers, sizeof(into.registers) ) == 0 &&
+           memcmp( before.block_ages, into.block_ages, sizeof(into.block_ages) ) == 0 &&
+           before.clobbered == into.clobbered && before.stored == into.stored &&
+           before.must == into.must && before.may == into.may && before.may_any == into.may_any);
+}
+
+
+// finds the loops, the instructions that can be run again without running anything outside them.
+// each group of instructions that can all reach each other gets its own number, the others get -1
+void find_loops( unsigned short pc, const vector<vector<unsigned short> > &edges, vector<int> &loops,
+                 vector<int> &order, vector<int> &lowest, vector<unsigned short> &stack, int &count )
+{
+  size_t i;
+  unsigned short other;
+  vector<unsigned short> members;
+
+  order[pc] = lowest[pc] = count++;
+  stack.push_back( pc );
+  loops[pc] = -2;   // on the stack
+
+  for ( i=0 ; i<edges[pc].size() ; i++ )
+  {
+    other = edges[pc][i];
+    if ( order[other] < 0 )
+    {
+      find_loops( other, edges, loops, order, lowest, stack, count );
+      lowest[pc] = min( lowest[pc], lowest[other] );
+    }
+    else if ( loops[other] == -2 )
+      lowest[pc] = min( lowest[pc], order[other] );
+  }
+
+  // pc is the first of its group we got to, so the group is everything above it on the stack
+  if ( lowest[pc] == order[pc] )
+  {
+    do
+    {
+      other = stack.back();
+      stack.pop_back();
+      members.push_back( other );
+    } while ( other != pc );
+
+    // a single instruction is only a loop if it branches to itself
+    if ( members.size() > 1 || find( edges[pc].begin(), edges[pc].end(), pc ) != edges[pc].end() )
+      for ( i=0 ; i<members.size() ; i++ )
+        loops[members[i]] = pc;
+    else
+      loops[pc] = -1;
+  }
+}
+
+
+// writes the instruction at the passed address the way the assembler would read it
+void disassemble( unsigned short pc, char *text )
+{
+  static const char *alu[] = { "ADD", "SUB", "AND", "OR", "XOR" };
+  static const char *branches[] = { "JR", "BEQ", "BNE", "BLT", "BGT", "BLE", "BGE" };
+  unsigned char opcode = code[pc][0] >> 5;
+  unsigned char mode = (code[pc][0] >> 2) & 0x07;
+  int reg1 = ((code[pc][0] & 0x03) << 2) | (code[pc][1] >> 6);
+  int reg2 = (code[pc][1] >> 2) & 0x0F;
+  int literal = code[pc][1] & 0x3F;
+  const char *packed = mode & PACKED_MODE ? "P" : "";
+  const char *saturate = mode & SATURATE_MODE ? "S" : "";
+
+  if ( literal & 0x20 )
+    literal -= 0x40;
+
+  if ( opcode <= XOR_OPCODE && (mode & 0x01) == 0 )
+    sprintf( text, "%s%s%s R%d,%d", packed, alu[opcode], saturate, reg1, literal );
+  else if ( opcode <= XOR_OPCODE )
+    sprintf( text, "%s%s%s R%d,R%d", packed, alu[opcode], saturate, reg1, reg2 );
+  else if ( opcode == MOVE_OPCODE && mode == BLOCK_MOVE_MODE )
+    sprintf( text, "MOVB [R%d],[R%d]", reg1, reg2 );
+  else if ( opcode == MOVE_OPCODE && mode == 0x05 )
+    sprintf( text, "MOVE [R%d],R%d", reg1, reg2 );
+  else if ( opcode == MOVE_OPCODE && mode == 0x04 )
+    sprintf( text, "MOVE [R%d],%d", reg1, literal );
+  else if ( opcode == MOVE_OPCODE && mode == 0x01 )
+    sprintf( text, "MOVE R%d,[R%d]", reg1, reg2 );
+  else if ( opcode == MOVE_OPCODE )
+    sprintf( text, "MOVE R%d,%d", reg1, literal );
+  else if ( opcode == SHIFT_OPCODE )
+    sprintf( text, "%s R%d", mode ? "SRL" : "SRR", reg1 );
+  else if ( mode == 0 )
+    sprintf( text, "JR R%d", reg1 );
+  else
+    sprintf( text, "%s R%d,%+d", branches[mode], reg1, literal );
+}
+
+
+// analyzes the loaded program and prints what each access does with the cache and how many misses it can have
+void analyze_cache( const char *data_filename )
+{
+  vector<struct ABSTRACT> states( CODE_SIZE );
+  vector<struct VERDICT> verdicts( CODE_SIZE );
+  vector<vector<unsigned short> > edges( CODE_SIZE );
+  vector<unsigned short> work;
+  vector<bool> queued( CODE_SIZE, false );
+  vector<unsigned short> next;
+  struct ABSTRACT state;
+  struct VERDICT verdict;
+  vector<int> loops( CODE_SIZE, -1 );
+  vector<int> order( CODE_SIZE, -1 );
+  vector<int> lowest( CODE_SIZE, -1 );
+  vector<unsigned short> stack;
+  map<int, long> loop_misses;
+  map<int, int> loop_last;
+  map<int, int> loop_size;
+  map<int, long>::iterator it;
+  long misses = 0;
+  long accesses = 0;
+  long always_hits = 0;
+  long always_misses = 0;
+  long unknown = 0;
+  bool unresolved = false;
+  int count = 0;
+  int pc;
+  size_t i;
+  char text[32];
+
+  // the program starts with every register clear and an empty cache
+  memset( state.registers, 0, sizeof(state.registers) );
+  for ( i=0 ; i<REGISTERS ; i++ )
+    state.block_ages[i] = -1;
+  state.clobbered = false;
+  state.may_any = false;
+  state.reached = true;
+  states[0] = state;
+  work.push_back( 0 );
+  queued[0] = true;
+
+  // keep going until nothing we know about any instruction changes
+  while ( !work.empty() )
+  {
+    pc = work.back();
+    work.pop_back();
+    queued[pc] = false;
+
+    state = states[pc];
+    analyze_instruction( pc, state, next, &verdict );
+    for ( i=0 ; i<next.size() ; i++ )
+    {
+      if ( join_state( states[next[i]], state ) && !queued[next[i]] )
+      {
+        work.push_back( next[i] );
+        queued[next[i]] = true;
+      }
+    }
+  }
+
+  // now that it's settled, the verdicts and control flow of every instruction the program can get to
+  for ( pc=0 ; pc<CODE_SIZE ; pc++ )
+  {
+    if ( states[pc].reached )
+    {
+      state = states[pc];
+      analyze_instruction( pc, state, edges[pc], &verdicts[pc] );
+    }
+  }
+  find_loops( 0, edges, loops, order, lowest, stack, count );
+
+  printf( "Static analysis of a %d block LRU cache with %d word blocks, for %s\n", cache_blocks, block_size,
+          analyze_any ? "any data" : data_filename );
+  printf( "  addr  instruction          accesses  always hit  always miss  unknown  block\n" );
+  for ( pc=0 ; pc<CODE_SIZE ; pc++ )
+  {
+    if ( !states[pc].reached )
+      continue;
+
+    disassemble( pc, text );
+    if ( verdicts[pc].accesses > 0 )
+    {
+      printf( "  %04x  %-20s %8d  %10d  %11d  %7d", pc, text, verdicts[pc].accesses, verdicts[pc].always_hits,
+              verdicts[pc].always_misses, verdicts[pc].unknown );
+      if ( verdicts[pc].block >= 0 )
+        printf( "  %04x\n", verdicts[pc].block );
+      else
+        printf( "  -\n" );
+    }
+    if ( verdicts[pc].unresolved )
+    {
+      printf( "  %04x  %-20s jumps somewhere we can't work out, the analysis doesn't follow it\n", pc, text );
+      unresolved = true;
+    }
+
+    accesses += verdicts[pc].accesses;
+    always_hits += verdicts[pc].always_hits;
+    always_misses += verdicts[pc].always_misses;
+    unknown += verdicts[pc].unknown;
+
+    // the instructions outside loops run at most once
+    if ( loops[pc] < 0 )
+      misses += verdicts[pc].always_misses + verdicts[pc].unknown;
+    else
+    {
+      loop_misses[loops[pc]] += verdicts[pc].always_misses + verdicts[pc].unknown;
+      loop_last[loops[pc]] = pc;
+      loop_size[loops[pc]]++;
+    }
+  }
+
+  printf( "Accesses: %ld, %ld always hit, %ld always miss, %ld unknown\n", accesses, always_hits, always_misses,
+          unknown );
+  if ( loop_misses.empty() )
+    printf( "Misses: at most %ld\n", misses );
+  else
+  {
+    printf( "Misses outside loops: at most %ld\n", misses );
+    for ( it=loop_misses.begin() ; it!=loop_misses.end() ; it++ )
+    {
+      for ( pc=0 ; loops[pc] != it->first ; pc++ )
+        ;
+      printf( "Loop %04x-%04x (%d instructions): at most %ld misses per pass through its instructions\n", pc, loop_last[it->first],
+              loop_size[it->first], it->second );
+    }
+  }
+  if ( unresolved )
+    printf( "These bounds only cover the code the analysis could follow\n" );
+  printf( "\n" );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// time slicing routines
+
+// with --program more than one program takes turns on the core, quantum instructions at a time, the way a
+// scheduler would run them. they share the core's cache, so each turn starts with whatever the others left
+// in it. the report gives each program's hits and misses, and how many of its blocks the others threw out.
+// partitioning gives each program its own blocks of the cache, so it can only throw out its own
+
+
+// counts the block with the passed tag being thrown out to make room for the current program
+void count_eviction( unsigned short tag )
+{
+  int owner = (tag << block_offset) / program_words;
+
+  if ( owner != current_program )
+  {
+    programs[owner].evicted++;
+    programs[current_program].evictions++;
+  }
+}
+
+
+// picks the block to fill in the current program's partition, an empty one or else the one its
+// replacement policy would pick
+int partition_block( struct CACHE *cache )
+{
+  struct PROGRAM *program = &programs[current_program];
+  int block_index = program->first_block;
+  int i;
+
+  for ( i=program->first_block ; i<program->first_block + program->blocks ; i++ )
+  {
+    if ( !cache->directory[i].valid )
+      return i;
+    if ( cache->directory[i].reference_count < cache->directory[block_index].reference_count )
+      block_index = i;
+  }
+
+  if ( cache_policy == RANDOM_POLICY )
+  {
+    cache->random = cache->random*1103515245 + 12345;
+    block_index = program->first_block + (int)((cache->random >> 16) % program->blocks);
+  }
+
+  return block_index;
+}
+
+
+// shares out the cache blocks between the programs from the --partition setting
+// returns false (after saying why) if they don't fit
+bool partition_cache()
+{
+  vector<int> shares;
+  const char *setting = partition_spec;
+  int first = 0;
+  int value;
+  size_t i;
+
+  if ( strcmp( setting, "equal" ) == 0 )
+    shares.assign( programs.size(), cache_blocks / programs.size() );
+  else
+  {
+    while ( sscanf( setting, "%d", &value ) == 1 && value > 0 )
+    {
+      shares.push_back( value );
+      setting = strchr( setting, ',' );
+      if ( setting == NULL )
+        break;
+      setting++;
+    }
+  }
+
+  for ( i=0 ; i<shares.size() ; i++ )
+    first += shares[i];
+  if ( shares.size() != programs.size() || shares[0] < 1 || first > cache_blocks )
+  {
+    printf( "a partition needs a share of at least 1 block for each of the %d programs, %d blocks in all\n",
+            (int)programs.size(), cache_blocks );
+    return false;
+  }
+
+  first = 0;
+  for ( i=0 ; i<programs.size() ; i++ )
+  {
+    programs[i].first_block = first;
+    programs[i].blocks = shares[i];
+    first += shares[i];
+  }
+
+  return true;
+}
+
+
+// puts a program back to the start, waiting for its first turn
+void initialize_program( struct PROGRAM *program )
+{
+  memset( &program->state, 0, sizeof(program->state) );
+  memset( program->registers, 0, sizeof(program->registers) );
+  program->phase = FETCH_INSTR;
+  program->branch_count = 0;
+  program->instructions = 0;
+  program->hits = 0;
+  program->misses = 0;
+  program->evicted = 0;
+  program->evictions = 0;
+}
+
+
+// puts the running program's registers and state away and gives the core the passed program's
+void switch_program( int next )
+{
+  struct PROGRAM *program = &programs[current_program];
+
+  if ( next == current_program )
+    return;
+
+  program->state = core->state;
+  memcpy( program->registers, core->registers, sizeof(program->registers) );
+  program->phase = core->phase;
+  program->branch_count = core->branch_count;
+  program->instructions = core->instructions;
+
+  program = &programs[next];
+  core->state = program->state;
+  memcpy( core->registers, program->registers, sizeof(core->registers) );
+  core->phase = program->phase;
+  core->branch_count = program->branch_count;
+  core->instructions = program->instructions;
+  memcpy( code, &program->code[0], sizeof(code) );
+
+  current_program = next;
+  program_switches++;
+}
+
+
+// runs the programs a turn at a time until they've all stopped
+void run_programs()
+{
+  int running = programs.size();
+  int hits;
+  int misses;
+  int i;
+
+  core = cores;
+  while ( running > 0 )
+  {
+    for ( i=0 ; i<(int)programs.size() ; i++ )
+    {
+      if ( i != current_program && programs[i].phase >= NUM_PHASES )
+        continue;
+
+      switch_program( i );
+      if ( core->phase >= NUM_PHASES )
+        continue;
+
+      hits = core->cache.hits;
+      misses = core->cache.misses;
+      run_instructions( quantum );
+      programs[i].hits += core->cache.hits - hits;
+      programs[i].misses += core->cache.misses - misses;
+
+      if ( core->phase >= NUM_PHASES )
+        running--;
+    }
+  }
+}
+
+
+// reports what each program did with the shared cache and what stopped it
+void print_programs()
+{
+  struct PROGRAM *program;
+  int switches = program_switches;   // before we switch between them to look
+  int i;
+
+  for ( i=0 ; i<(int)programs.size() ; i++ )
+  {
+    switch_program( i );
+    program = &programs[i];
+
+    printf( "Program %d (%s, %s):\n", i, program->code_file.c_str(), program->data_file.c_str() );
+    printf( "Instructions: %lu\n", core->instructions );
+    printf( "Hits: %d\n", program->hits );
+    printf( "Misses: %d\n", program->misses );
+    printf( "Hit rate: %.2f%%\n",
+            program->hits + program->misses > 0 ? 100.0 * program->hits / (program->hits + program->misses) : 0.0 );
+    printf( "Blocks thrown out by other programs: %d\n", program->evicted );
+    printf( "Other programs' blocks thrown out: %d\n", program->evictions );
+    if ( program->blocks > 0 )
+      printf( "Partition: blocks %d-%d\n", program->first_block, program->first_block + program->blocks - 1 );
+    printf( "\n" );
+    print_stop_reason( core );
+  }
+
+  printf( "Context switches: %d, every %d instruction(s)\n\n", switches, quantum );
+}
+
+
+////////////////////////////////////////////////////////////////////
+// general routines
+
+
+// puts a core back into its starting state, registers cleared (except for its number in R15)
+// and an empty cache and TLB
+void initialize_core( struct CORE *the_core, int id )
+{
+  int i;
+
+  the_core->id = id;
+  the_core->phase = FETCH_INSTR;  // we always start if an instruction fetch
+  the_core->branch_count = 0;
+  the_core->instructions = 0;
+
+  the_core->state.PC = 0;
+  the_core->state.MDR = 0;
+  the_core->state.MAR = 0;
+  the_core->state.ALU_x = 0;
+  the_core->state.ALU_y = 0;
+  the_core->state.ALU_z = 0;
+
+  // initialize our registers
+  for ( i=0 ; i<REGISTERS ; i++ )
+    the_core->registers[i] = 0;
+  the_core->registers[CORE_REGISTER] = id;
+
+  // intializes hit and miss tracking
+  the_core->cache.hits = 0;
+  the_core->cache.misses = 0;
+  the_core->cache.invalidations = 0;
+  the_core->cache.upgrades = 0;
+  the_core->cache.coherence_misses = 0;
+  the_core->cache.interventions = 0;
+
+  // nothing has been used yet and the shadow cache starts out empty
+  the_core->cache.compulsory_misses = 0;
+  the_core->cache.capacity_misses = 0;
+  the_core->cache.conflict_misses = 0;
+  the_core->cache.seen.assign( MAX_DATA_SIZE / block_size, false );
+  the_core->cache.shadow_tags.assign( cache_blocks, 0 );
+  initialize_recency( &the_core->cache.shadow_recency, cache_blocks );
+  the_core->cache.shadow_used = 0;
+  the_core->cache.shadow_slots.assign( MAX_DATA_SIZE / block_size, -1 );
+
+  // initialize the least recently used global counter
+  the_core->cache.lru_global_counter = 0;
+  the_core->cache.random = 1;
+
+	// initialize the valid bit, dirty bit and value used to track the reference count
+  // for every cache block in the cache directory
+  the_core->cache.directory.resize( cache_blocks );
+  for ( i=0 ; i<cache_blocks ; i++ )
+  {
+	 	the_core->cache.directory[i].valid = false;
+	  the_core->cache.directory[i].dirty = false;
+	  the_core->cache.directory[i].shared = false;
+    the_core->cache.directory[i].reference_count = 0;
+  }
+
+  // nothing is in the index, and the recency list starts out in directory order
+  the_core->cache.tag_index.assign( MAX_DATA_SIZE / block_size, -1 );
+  the_core->cache.valid_blocks = 0;
+  initialize_recency( &the_core->cache.recency, cache_blocks );
+
+  // no need to fill the cache memory array, nothing is read from a block until its valid bit is set
+  the_core->cache.memory.resize( cache_blocks * block_size * WORD_SIZE );
+
+  // the victim cache starts out empty too
+  the_core->cache.victims.resize( victim_blocks );
+  for ( i=0 ; i<victim_blocks ; i++ )
+  {
+    the_core->cache.victims[i].valid = false;
+    the_core->cache.victims[i].dirty = false;
+    the_core->cache.victims[i].shared = false;
+    the_core->cache.victims[i].reference_count = 0;
+  }
+  the_core->cache.victim_memory.resize( victim_blocks * block_size * WORD_SIZE );
+  the_core->cache.victim_hits = 0;
+
+  // we only need to remember invalidated blocks if there are other caches to invalidate them
+  the_core->cache.lost.assign( num_cores > 1 ? MAX_DATA_SIZE / block_size : 0, false );
+
+  // the TLB starts out empty
+  for ( i=0 ; i<MAX_TLB_ENTRIES ; i++ )
+    the_core->tlb.entries[i].valid = false;
+  the_core->tlb.hits = 0;
+  the_core->tlb.misses = 0;
+  the_core->tlb.counter = 0;
+  the_core->tlb.random = 1;
+
+  the_core->cache.writebacks = 0;
+  the_core->cache.sector_valid.assign( sectors > 0 ? cache_blocks : 0, 0 );
+  the_core->cache.sector_dirty.assign( sectors > 0 ? cache_blocks : 0, 0 );
+  the_core->cache.sector_misses = 0;
+  the_core->cache.words_read = 0;
+  the_core->cache.words_written = 0;
+
+  // so does the telemetry
+  the_core->telemetry.window = 0;
+  the_core->telemetry.instructions = 0;
+  the_core->telemetry.hits = 0;
+  the_core->telemetry.misses = 0;
+  the_core->telemetry.writebacks = 0;
+  the_core->telemetry.used.assign( telemetry_file != NULL ? MAX_DATA_SIZE / block_size : 0, -1 );
+  the_core->telemetry.working_set = 0;
+  the_core->telemetry.executed.assign( telemetry_file != NULL ? CODE_SIZE : 0, -1 );
+  the_core->telemetry.code_set = 0;
+  the_core->telemetry.previous_code = 0;
+  the_core->telemetry.common_code = 0;
+  the_core->telemetry.phases.clear();
+
+  // so does the timing
+  the_core->timing.cycle = 0;
+  for ( i=0 ; i<REGISTERS ; i++ )
+    the_core->timing.ready[i] = 0;
+  the_core->timing.mshrs.clear();
+  the_core->timing.load_stalls = 0;
+  the_core->timing.mshr_stalls = 0;
+  the_core->timing.primary_misses = 0;
+  the_core->timing.merged_misses = 0;
+  the_core->timing.peak = 0;
+
+  the_core->scratchpad_accesses = 0;
+
+  // profiling starts from nothing too
+  if ( profile_source != NULL )
+  {
+    struct PROFILE none = { 0, 0, 0, 0 };
+    the_core->profile.assign( CODE_SIZE, none );
+  }
+  else
+    the_core->profile.clear();
+}
+
+
+// Initialize memory and every core
+void initialize_system()
+{
+  int i;
+
+  // code space is filled in load_files() once we know how much of it the program uses
+
+  // throw away any data pages from a previous run, everything else already reads as filler
+  memset( filler_page, MEM_FILLER, sizeof(filler_page) );
+  for ( i=0 ; i<(int)touched_pages.size() ; i++ )
+  {
+    delete[] data[touched_pages[i]];
+    data[touched_pages[i]] = NULL;
+  }
+  touched_pages.clear();
+
+  // nothing is mapped yet
+  for ( i=0 ; i<DATA_PAGES ; i++ )
+    page_table[i] = -1;
+  next_frame = 0;
+  page_faults = 0;
+
+  // pick the cache model to use for this geometry before anything touches a cache
+  block_offset = log2_of( block_size );
+  if ( sectors > 0 )
+  {
+    sector_words = block_size / sectors;
+    sector_offset = log2_of( sector_words );
+  }
+  select_cache_model();
+  initialize_dram();
+
+  // the scratchpad sits in front of the cache
+  if ( scratchpad_words > 0 )
+  {
+    model_load = load_data;
+    model_store = store_data;
+    load_data = scratchpad_load;
+    store_data = scratchpad_store;
+  }
+
+  for ( i=0 ; i<num_cores ; i++ )
+    initialize_core( &cores[i], i );
+
+  for ( i=0 ; i<(int)programs.size() ; i++ )
+    initialize_program( &programs[i] );
+  current_program = 0;
+  program_switches = 0;
+
+  window_hits.clear();
+  window_misses.clear();
+  skipped_accesses = 0;
+  functional = false;
+
+  start_telemetry();
+}
+
+
+// checks the hex value to ensure it a printable ASCII character. If
+// it isn't, '.' is returned instead of itself
+char valid_ascii( unsigned char hex_value )
+{
+  if ( hex_value < 0x21 || hex_value > 0x7e )
+    hex_value = '.';
+  
+  return (char)hex_value;
+}
+
+
+// takes the data from the passed address and prints it out in hexadecimal and ASCII form
+void print_memory( int first )
+{
+  int count = 0;
+  int text_index = 0;
+  unsigned char *word;
+  char the_text[LINE_LENGTH+1];
+
+  // print each line 1 at a time
+  for ( count=0 ; count<data_size ; count++ ) {
+    if ( text_index == 0 )
+    {
+      // for each word we're printing 2 bytes, so the counter
+      // should be twice count.
+      printf( "%08x  ", count*2 );
+    }
+
+    if ( scratchpad_words > 0 && in_scratchpad[first + count] )
+      word = &scratchpad[(first + count)*WORD_SIZE];
+    else
+      word = data_word( first + count, false );
+    the_text[text_index++] = valid_ascii( word[0] );
+    the_text[text_index++] = valid_ascii( word[1] );
+    printf( "%02x %02x ", word[0], word[1] );
+
+    // print out a line if we're at the end
+    if ( text_index == LINE_LENGTH )
+    {
+      text_index = 0;
+      the_text[LINE_LENGTH] = '\0';
+      printf( " |%s|\n", the_text );
+    }
+  }
+
+  // a data size that isn't a whole number of lines leaves a short last line, padded out to line up
+  if ( text_index > 0 )
+  {
+    the_text[text_index] = '\0';
+    printf( "%*s |%s|\n", (LINE_LENGTH - text_index) / 2 * 6, "", the_text );
+  }
+}
+
+
+// prints the data area, each program's if they took turns
+void print_data_memory()
+{
+  int i;
+
+  if ( programs.empty() )
+    print_memory( 0 );
+  for ( i=0 ; i<(int)programs.size() ; i++ )
+  {
+    printf( "Program %d data:\n", i );
+    print_memory( programs[i].base );
+  }
+}
+
+
+// converts the passed string into binary form and inserts it into our data area
+// starting at the passed word address, which is advanced past the inserted words.
+// the address is from the start of the program's data memory at base
+// assumes an even number of words!!!
+void insert_data( string line, int &address, int base )
+{
+  unsigned int  i;
+  char          ascii_data[5];
+  unsigned char byte1;
+  unsigned char byte2;
+  unsigned char *word;
+  
+  ascii_data[4] = '\0';
+
+  for (i=0 ; i<line.length() ; i+=4 )
+  {
+  	ascii_data[0] = line[i];
+    ascii_data[1] = line[i+1];
+    ascii_data[2] = line[i+2];
+    ascii_data[3] = line[i+3];
+      
+    sscanf(ascii_data, "%02hhx%02hhx", &byte1, &byte2);
+
+    // anything beyond the end of data memory is ignored
+    // with virtual memory on the image is loaded at virtual addresses, without touching the TLB
+    if ( address < data_size ) {
+      if ( tlb_entries > 0 )
+        word = data_word( (walk_page_table( address >> PAGE_OFFSET ) << PAGE_OFFSET) | (address & (PAGE_WORDS - 1)), true );
+      else
+        word = data_word( base + address, true );
+      word[0] = byte1;
+      word[1] = byte2;
+      address++;
+    }
+  }
+}
+
+
+// returns the contents of the named file, from the ones we've already read if it hasn't changed
+// returns false if it can't be read
+bool read_file( const char *file_name, string &contents )
+{
+  struct stat status;
+  std::ifstream file;
+  std::ostringstream text;
+  map<string, struct IMAGE>::iterator image = images.find( file_name );
+  bool rc = stat( file_name, &status ) == 0;
+
+  if ( rc && image != images.end() && image->second.modified.tv_sec == status.st_mtim.tv_sec &&
+       image->second.modified.tv_nsec == status.st_mtim.tv_nsec && image->second.size == status.st_size )
+    contents = image->second.contents;
+
+  else if ( rc )
+  {
+    file.open( file_name, std::ios::binary );
+    rc = file.is_open();
+    if ( rc )
+    {
+      text << file.rdbuf();
+      contents = text.str();
+      images[file_name].modified = status.st_mtim;
+      images[file_name].size = status.st_size;
+      images[file_name].contents = contents;
+    }
+  }
+
+  return rc;
+}
+
+
+// reads a program's code into the passed code area and its data into data memory from the passed base
+// returns true if both files were read
+bool read_program( const char *code_filename, const char *data_filename, unsigned char *code_area, int base )
+{
+  string         code_image;
+  string         data_image;
+  string         line;           // used to read in a line of text
+  bool           rc = false;
+  int            code_bytes;     // how much of the code area the program filled
+  int            address = 0;    // where the next word of data goes
+  
+  // since we're allowing anything to be specified, make sure it's a file...
+  if ( read_file( code_filename, code_image ) )
+  {
+    // put the code into the code area
+    code_bytes = min( (int)code_image.length(), CODE_SIZE*WORD_SIZE );
+    memcpy( code_area, code_image.data(), code_bytes );
+
+    // fill the rest of our code space with illegal instructions
+    memset( code_area + code_bytes, MEM_FILLER, CODE_SIZE*WORD_SIZE - code_bytes );
+    
+    // since we're allowing anything to be specified, make sure it's a file...
+    if ( read_file( data_filename, data_image ) )
+    {
+      std::istringstream data_file( data_image );
+
+      // read the data into our data area
+      getline( data_file, line );
+      while ( !data_file.eof() )
+      {
+        // put the data into the data area
+        insert_data( line, address, base );
+        
+        getline( data_file, line );
+      }
+      
+      // both files were read so we can continue processing
+      rc = true;
+    }
+  }
+  
+  return rc;
+}
+
+
+// reads in the file data and returns true is our code and data areas are ready for processing
+bool load_files( const char *code_filename, const char *data_filename )
+{
+  bool rc = read_program( code_filename, data_filename, (unsigned char *)code, 0 );
+  int  i;
+
+  // the scratchpad's words start out as the program's data put them
+  if ( rc && scratchpad_words > 0 )
+    fill_scratchpad();
+
+  // the other programs taking turns keep their code until it's their turn, the first one starts in the code area
+  for ( i=0 ; i<(int)programs.size() && rc ; i++ )
+  {
+    programs[i].code.resize( CODE_SIZE*WORD_SIZE );
+    if ( i == 0 )
+      memcpy( &programs[i].code[0], code, sizeof(code) );
+    else if ( !read_program( programs[i].code_file.c_str(), programs[i].data_file.c_str(), &programs[i].code[0],
+                             programs[i].base ) )
+    {
+      printf( "couldn't read %s and %s\n", programs[i].code_file.c_str(), programs[i].data_file.c_str() );
+      rc = false;
+    }
+  }
+
+  return rc;
+}
+
+
+// parses the optional settings that follow the code and data file names
+// returns false (after saying why) if an option isn't recognized or its value is out of range
+bool parse_options( int argc, const char *argv[] )
+{
+  bool rc = true;
+  int  i;
+  int  value;
+  struct GEOMETRY model;
+  const char *option;
+  const char *setting;
+
+  // a server gets its code and data files from each job, so it can be started with just options
+  int  first = argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0' ? 1 : 3;
+
+  if ( first == 3 && argc < 3 )
+  {
+    printf( "usage: %s <code.o> <memory.dat> [options]\n       %s --serve <socket> [options]\n", argv[0], argv[0] );
+    printf( "  --cores <cores>          number of cores sharing data memory (1-%d, default 1)\n", MAX_CORES );
+    printf( "  --schedule <schedule>    threads gives each core a host thread, round-robin takes turns (default threads)\n" );
+    printf( "  --quantum <instructions> instructions per turn with round-robin (default 1)\n" );
+    printf( "  -m <words>               size of data memory in words (1-%d, default %d)\n", MAX_DATA_SIZE, DATA_SIZE );
+    printf( "  -b <blocks>              number of cache blocks (1-%d, default %d)\n", MAX_CACHE_BLOCKS, CACHE_BLOCKS );
+    printf( "  -s <words>               words per cache block, a power of 2 up to %d (default %d)\n", PAGE_WORDS, BLOCK_SIZE );
+    printf( "  --policy <policy>        cache replacement, lru, fifo or random (default lru)\n" );
+    printf( "  --victim <blocks>        add a victim cache with this many blocks (up to %d, default 0)\n", MAX_VICTIM_BLOCKS );
+    printf( "  --sample-interval <instructions> measure a window of every this many instructions (default 0, everything)\n" );
+    printf( "  --sample-warmup <instructions>   detailed instructions before each window to warm the cache up\n" );
+    printf( "  --sample-window <instructions>   detailed instructions measured in each window\n" );
+    printf( "  --tlb <entries>          turn on virtual memory with a TLB of this many entries (up to %d)\n", MAX_TLB_ENTRIES );
+    printf( "  --tlb-ways <ways>        TLB associativity (default fully associative)\n" );
+    printf( "  --tlb-policy <policy>    TLB replacement, lru, fifo or random (default lru)\n" );
+    printf( "  --walk-cycles <cycles>   cost of a page walk on a TLB miss (default %d)\n", WALK_CYCLES );
+    printf( "  --checkpoint-at <instructions> save a checkpoint once each core has run this many instructions\n" );
+    printf( "  --checkpoint <file>      where to save the checkpoint\n" );
+    printf( "  --restore <file>         start from a checkpoint instead of the code and data files\n" );
+    printf( "  --fork <file>            with --restore, a run from the checkpoint for each line of options in the file\n" );
+    printf( "  --trace <file>           run a trace of memory references through the cache instead, - for stdin\n" );
+    printf( "  --trace-format <format>  din for Dinero text lines or binary for packed records (default din)\n" );
+    printf( "  --layout <prefix>        propose a data layout with fewer misses, written to prefix.dat and prefix.map\n" );
+    printf( "  --remap <file.map>       run with the data laid out as the map says (use the matching .dat)\n" );
+    printf( "  --profile <file.asm>     list the source with each line's executions, hits, misses and taken branches\n" );
+    printf( "  --sectors <sectors>      split each block into this many sectors, filled and written back separately\n" );
+    printf( "  --mshrs <registers>      time a non-blocking cache with this many MSHRs (up to %d, default 0, off)\n", MAX_MSHRS );
+    printf( "  --miss-cycles <cycles>   time to fetch a block from main memory (default %d)\n", MISS_CYCLES );
+    printf( "  --dram-banks <banks>     put a DRAM of this many banks behind the caches (a power of 2 up to %d, default 0)\n",
+            MAX_DRAM_BANKS );
+    printf( "  --dram-row <words>       words in a DRAM row (default %d)\n", DRAM_ROW_WORDS );
+    printf( "  --dram-page <policy>     open keeps a row open after an access, closed closes it (default open)\n" );
+    printf( "  --dram-map <map>         interleave the banks by row or by block (default row)\n" );
+    printf( "  --dram-hit <cycles>      row buffer hit latency (default %d)\n", DRAM_HIT_CYCLES );
+    printf( "  --dram-miss <cycles>     latency of opening a row in a closed bank (default %d)\n", DRAM_MISS_CYCLES );
+    printf( "  --dram-conflict <cycles> latency of closing another row and opening this one (default %d)\n",
+            DRAM_CONFLICT_CYCLES );
+    printf( "  --telemetry <file.csv>   write the cache statistics for every window of the run, and find its phases\n" );
+    printf( "  --telemetry-window <n>   instructions (or accesses) in a telemetry window (default %d)\n", TELEMETRY_WINDOW );
+    printf( "  --telemetry-by <unit>    instructions or accesses (default instructions)\n" );
+    printf( "  --decouple <records>     run the cache on its own thread behind a queue of this many accesses (a power of 2)\n" );
+    printf( "  --decouple-model <b>x<s> another cache of b blocks of s words for a decoupled run to drive (up to %d)\n",
+            MAX_DECOUPLE_MODELS );
+    printf( "  --program <code.o>,<memory.dat> another program to take turns with, quantum instructions at a time\n" );
+    printf( "  --partition <shares>     give each program its own blocks, equal or a comma separated list of blocks\n" );
+    printf( "  --scratchpad <file.pad>  keep the data regions the assembler listed in a scratchpad instead of the cache\n" );
+    printf( "  --results <directory>    keep each run's output in a store and print it instead of running it again\n" );
+    printf( "  --results-mode <mode>    use a stored run, verify it against a fresh one or refresh it (default use)\n" );
+    printf( "  --analyze <dat|any>      work out the cache's behaviour without running, for the .dat's data or any data\n" );
+    printf( "  --serve <socket>         run jobs from a Unix socket, or - for stdin, a line of <code.o> <memory.dat> [options] each\n"
+            "                           (the server's own code and data files can be left out)\n" );
+    rc = false;
+  }
+
+  for ( i=first ; i<argc && rc ; i+=2 )
+  {
+    option = argv[i];
+    setting = i+1 < argc ? argv[i+1] : NULL;
+    value = -1;
+
+    // every option takes a value
+    if ( setting == NULL )
+    {
+      printf( "option %s needs a value\n", option );
+      rc = false;
+    }
+
+    else if ( strcmp( option, "--policy" ) == 0 )
+    {
+      if ( strcmp( setting, "lru" ) == 0 )
+        cache_policy = LRU_POLICY;
+      else if ( strcmp( setting, "fifo" ) == 0 )
+        cache_policy = FIFO_POLICY;
+      else if ( strcmp( setting, "random" ) == 0 )
+        cache_policy = RANDOM_POLICY;
+      else
+      {
+        printf( "cache policy must be lru, fifo or random\n" );
+        rc = false;
+      }
+    }
+
+    else if ( strcmp( option, "--tlb-policy" ) == 0 )
+    {
+      if ( strcmp( setting, "lru" ) == 0 )
+        tlb_policy = LRU_POLICY;
+      else if ( strcmp( setting, "fifo" ) == 0 )
+        tlb_policy = FIFO_POLICY;
+      else if ( strcmp( setting, "random" ) == 0 )
+        tlb_policy = RANDOM_POLICY;
+      else
+      {
+        printf( "TLB policy must be lru, fifo or random\n" );
+        rc = false;
+      }
+    }
+
+    else if ( strcmp( option, "--dram-page" ) == 0 )
+    {
+      if ( strcmp( setting, "open" ) == 0 )
+        dram_closed_page = false;
+      else if ( strcmp( setting, "closed" ) == 0 )
+        dram_closed_page = true;
+      else
+      {
+        printf( "DRAM page policy must be open or closed\n" );
+        rc = false;
+      }
+    }
+
+    else if ( strcmp( option, "--dram-map" ) == 0 )
+    {
+      if ( strcmp( setting, "row" ) == 0 )
+        dram_block_map = false;
+      else if ( strcmp( setting, "block" ) == 0 )
+        dram_block_map = true;
+      else
+      {
+        printf( "DRAM bank mapping must be row or block\n" );
+        rc = false;
+      }
+    }
+
+    else if ( strcmp( option, "--schedule" ) == 0 )
+    {
+      if ( strcmp( setting, "threads" ) == 0 )
+        threaded = schedule_threads = true;
+      else if ( strcmp( setting, "round-robin" ) == 0 )
+        threaded = schedule_threads = false;
+      else
+      {
+        printf( "schedule must be threads or round-robin\n" );
+        rc = false;
+      }
+    }
+
+    else if ( strcmp( option, "--checkpoint" ) == 0 )
+      checkpoint_file = setting;
+
+    else if ( strcmp( option, "--restore" ) == 0 )
+      restore_file = setting;
+
+    else if ( strcmp( option, "--fork" ) == 0 )
+      fork_file = setting;
+
+    else if ( strcmp( option, "--trace" ) == 0 )
+      trace_file = setting;
+
+    else if ( strcmp( option, "--layout" ) == 0 )
+      layout_prefix = setting;
+
+    else if ( strcmp( option, "--remap" ) == 0 )
+      remap_file = setting;
+
+    else if ( strcmp( option, "--profile" ) == 0 )
+      profile_source = setting;
+
+    else if ( strcmp( option, "--serve" ) == 0 )
+      serve_path = setting;
+
+    else if ( strcmp( option, "--telemetry" ) == 0 )
+      telemetry_file = setting;
+
+    else if ( strcmp( option, "--telemetry-by" ) == 0 )
+    {
+      if ( strcmp( setting, "instructions" ) == 0 )
+        window_by_accesses = false;
+      else if ( strcmp( setting, "accesses" ) == 0 )
+        window_by_accesses = true;
+      else
+      {
+        printf( "telemetry windows are by instructions or accesses\n" );
+        rc = false;
+      }
+    }
+
+    else if ( strcmp( option, "--program" ) == 0 )
+    {
+      struct PROGRAM program;
+      const char *comma = strchr( setting, ',' );
+
+      if ( comma == NULL || comma == setting || comma[1] == '\0' )
+      {
+        printf( "a program is given as <code.o>,<memory.dat>\n" );
+        rc = false;
+      }
+      else
+      {
+        program.code_file.assign( setting, comma - setting );
+        program.data_file = comma + 1;
+        program.first_block = 0;
+        program.blocks = 0;
+        programs.push_back( program );
+      }
+    }
+
+    else if ( strcmp( option, "--scratchpad" ) == 0 )
+      scratchpad_file = setting;
+
+    else if ( strcmp( option, "--results" ) == 0 )
+      results_path = setting;
+
+    else if ( strcmp( option, "--results-mode" ) == 0 )
+    {
+      if ( strcmp( setting, "use" ) == 0 )
+        results_mode = USE_RESULTS;
+      else if ( strcmp( setting, "verify" ) == 0 )
+        results_mode = VERIFY_RESULTS;
+      else if ( strcmp( setting, "refresh" ) == 0 )
+        results_mode = REFRESH_RESULTS;
+      else
+      {
+        printf( "the results mode must be use, verify or refresh\n" );
+        rc = false;
+      }
+    }
+
+    else if ( strcmp( option, "--partition" ) == 0 )
+      partition_spec = setting;
+
+    else if ( strcmp( option, "--analyze" ) == 0 )
+    {
+      analyze = true;
+      if ( strcmp( setting, "dat" ) == 0 )
+        analyze_any = false;
+      else if ( strcmp( setting, "any" ) == 0 )
+        analyze_any = true;
+      else
+      {
+        printf( "the analysis is for the data in the .dat (dat) or any data (any)\n" );
+        rc = false;
+      }
+    }
+
+    else if ( strcmp( option, "--trace-format" ) == 0 )
+    {
+      if ( strcmp( setting, "din" ) == 0 )
+        trace_binary = false;
+      else if ( strcmp( setting, "binary" ) == 0 )
+        trace_binary = true;
+      else
+      {
+        printf( "trace format must be din or binary\n" );
+        rc = false;
+      }
+    }
+
+    // another cache model for a decoupled run to drive, <blocks>x<words> with the limits of -b and -s
+    else if ( strcmp( option, "--decouple-model" ) == 0 )
+    {
+      if ( sscanf( setting, "%dx%d", &model.blocks, &model.words ) != 2 ||
+           model.blocks < 1 || model.blocks > MAX_CACHE_BLOCKS ||
+           model.words < 1 || model.words > PAGE_WORDS || (model.words & (model.words - 1)) != 0 )
+      {
+        printf( "a model is <blocks>x<words>, 1 to %d blocks of a power of 2 up to %d words\n",
+                MAX_CACHE_BLOCKS, PAGE_WORDS );
+        rc = false;
+      }
+      else if ( decouple_models.size() == MAX_DECOUPLE_MODELS )
+      {
+        printf( "a decoupled run can have at most %d other models\n", MAX_DECOUPLE_MODELS );
+        rc = false;
+      }
+      else
+        decouple_models.push_back( model );
+    }
+
+    // the rest are all numbers
+    else if ( sscanf( setting, "%d", &value ) != 1 || value < 0 )
+    {
+      printf( "option %s needs a numeric value\n", option );
+      rc = false;
+    }
+
+    else if ( strcmp( option, "-m" ) == 0 )
+    {
+      if ( value < 1 || value > MAX_DATA_SIZE )
+      {
+        printf( "data memory size must be between 1 and %d words\n", MAX_DATA_SIZE );
+        rc = false;
+      }
+      data_size = value;
+    }
+
+    else if ( strcmp( option, "-b" ) == 0 )
+    {
+      if ( value < 1 || value > MAX_CACHE_BLOCKS )
+      {
+        printf( "the cache must have between 1 and %d blocks\n", MAX_CACHE_BLOCKS );
+        rc = false;
+      }
+      cache_blocks = value;
+    }
+
+    else if ( strcmp( option, "-s" ) == 0 )
+    {
+      // offsets are masked off so the block size has to be a power of 2, and a block can't straddle pages
+      if ( value < 1 || value > PAGE_WORDS || (value & (value - 1)) != 0 )
+      {
+        printf( "the block size must be a power of 2 between 1 and %d words\n", PAGE_WORDS );
+        rc = false;
+      }
+      block_size = value;
+    }
+
+    else if ( strcmp( option, "--victim" ) == 0 )
+    {
+      if ( value > MAX_VICTIM_BLOCKS )
+      {
+        printf( "the victim cache can have at most %d blocks\n", MAX_VICTIM_BLOCKS );
+        rc = false;
+      }
+      victim_blocks = value;
+    }
+
+    else if ( strcmp( option, "--tlb" ) == 0 )
+    {
+      if ( value > MAX_TLB_ENTRIES )
+      {
+        printf( "the TLB can have at most %d entries\n", MAX_TLB_ENTRIES );
+        rc = false;
+      }
+      tlb_entries = value;
+    }
+
+    else if ( strcmp( option, "--cores" ) == 0 )
+    {
+      if ( value < 1 || value > MAX_CORES )
+      {
+        printf( "there must be between 1 and %d cores\n", MAX_CORES );
+        rc = false;
+      }
+      num_cores = value;
+    }
+
+    else if ( strcmp( option, "--quantum" ) == 0 )
+    {
+      if ( value < 1 )
+      {
+        printf( "the quantum must be at least 1 instruction\n" );
+        rc = false;
+      }
+      quantum = value;
+    }
+
+    else if ( strcmp( option, "--sample-interval" ) == 0 )
+      sample_interval = value;
+
+    else if ( strcmp( option, "--sample-warmup" ) == 0 )
+      sample_warmup = value;
+
+    else if ( strcmp( option, "--sample-window" ) == 0 )
+      sample_window = value;
+
+    else if ( strcmp( option, "--tlb-ways" ) == 0 )
+      tlb_ways = value;
+
+    else if ( strcmp( option, "--walk-cycles" ) == 0 )
+      walk_cycles = value;
+
+    else if ( strcmp( option, "--sectors" ) == 0 )
+    {
+      if ( value > MAX_SECTORS || (value & (value - 1)) != 0 )
+      {
+        printf( "the number of sectors must be a power of 2 up to %d\n", MAX_SECTORS );
+        rc = false;
+      }
+      sectors = value;
+    }
+
+    else if ( strcmp( option, "--mshrs" ) == 0 )
+    {
+      if ( value > MAX_MSHRS )
+      {
+        printf( "there can be at most %d MSHRs\n", MAX_MSHRS );
+        rc = false;
+      }
+      mshr_count = value;
+    }
+
+    else if ( strcmp( option, "--miss-cycles" ) == 0 )
+    {
+      if ( value < 1 )
+      {
+        printf( "a miss must take at least 1 cycle\n" );
+        rc = false;
+      }
+      miss_cycles = value;
+    }
+
+    else if ( strcmp( option, "--dram-banks" ) == 0 )
+    {
+      // the bank is picked with a mask
+      if ( value > MAX_DRAM_BANKS || (value & (value - 1)) != 0 )
+      {
+        printf( "the number of DRAM banks must be a power of 2 up to %d\n", MAX_DRAM_BANKS );
+        rc = false;
+      }
+      dram_banks = value;
+    }
+
+    else if ( strcmp( option, "--dram-row" ) == 0 )
+      dram_row = value;
+
+    else if ( strcmp( option, "--dram-hit" ) == 0 )
+      dram_hit = value;
+
+    else if ( strcmp( option, "--dram-miss" ) == 0 )
+      dram_miss = value;
+
+    else if ( strcmp( option, "--dram-conflict" ) == 0 )
+      dram_conflict = value;
+
+    else if ( strcmp( option, "--telemetry-window" ) == 0 )
+    {
+      if ( value < 1 )
+      {
+        printf( "a telemetry window must be at least 1\n" );
+        rc = false;
+      }
+      telemetry_window = value;
+    }
+
+    else if ( strcmp( option, "--checkpoint-at" ) == 0 )
+      checkpoint_at = value;
+
+    else if ( strcmp( option, "--decouple" ) == 0 )
+    {
+      // the queue wraps with a mask
+      if ( value != 0 && (value < 2 || value > MAX_DECOUPLE_RECORDS || (value & (value - 1)) != 0) )
+      {
+        printf( "the access queue must be a power of 2 between 2 and %d records\n", MAX_DECOUPLE_RECORDS );
+        rc = false;
+      }
+      decouple_records = value;
+    }
+
+    else
+    {
+      printf( "unknown option %s\n", option );
+      rc = false;
+    }
+  }
+
+  // only a server can do without the code and data files
+  if ( rc && first == 1 && (serve_path == NULL || !programs.empty()) )
+  {
+    printf( "the code and data files can only be left out with --serve\n" );
+    rc = false;
+  }
+
+  // the sets have to divide the TLB evenly
+  if ( rc && tlb_entries > 0 && tlb_ways > 0 && (tlb_ways > tlb_entries || tlb_entries % tlb_ways != 0) )
+  {
+    printf( "TLB ways must evenly divide the number of TLB entries\n" );
+    rc = false;
+  }
+
+  // the warm-up and window have to fit in the interval, and sampling only follows one core
+  if ( rc && sample_interval > 0 && (sample_window < 1 || sample_warmup + sample_window > sample_interval) )
+  {
+    printf( "the sample window must be at least 1 instruction and fit in the interval with the warm-up\n" );
+    rc = false;
+  }
+  if ( rc && sample_interval > 0 && num_cores > 1 )
+  {
+    printf( "sampling only works with a single core\n" );
+    rc = false;
+  }
+
+  // a checkpoint has to be taken between instructions, which only taking turns guarantees
+  if ( rc && (checkpoint_at > 0) != (checkpoint_file != NULL) )
+  {
+    printf( "--checkpoint-at and --checkpoint go together\n" );
+    rc = false;
+  }
+  if ( rc && checkpoint_at > 0 && (sample_interval > 0 || (num_cores > 1 && threaded)) )
+  {
+    printf( "checkpoints can't be taken while sampling or with threads, use --schedule round-robin\n" );
+    rc = false;
+  }
+  if ( rc && fork_file != NULL && restore_file == NULL )
+  {
+    printf( "--fork needs a checkpoint to --restore\n" );
+    rc = false;
+  }
+
+  // a trace replaces running a program
+  if ( rc && trace_file != NULL &&
+       (num_cores > 1 || sample_interval > 0 || checkpoint_at > 0 || restore_file != NULL) )
+  {
+    printf( "a trace runs through a single cache, without sampling or checkpoints\n" );
+    rc = false;
+  }
+
+  // the layout is for one program on one cache
+  if ( rc && layout_prefix != NULL && (num_cores > 1 || trace_file != NULL || fork_file != NULL) )
+  {
+    printf( "a layout can only be proposed for a single core running a program\n" );
+    rc = false;
+  }
+  if ( rc && remap_file != NULL && !read_remap( remap_file ) )
+    rc = false;
+
+  // a decoupled cache only follows one core, running the program as it goes
+  if ( rc && decouple_records > 0 &&
+       (num_cores > 1 || sample_interval > 0 || checkpoint_at > 0 || trace_file != NULL || mshr_count > 0) )
+  {
+    printf( "a decoupled cache only works with a single core, without sampling, checkpoints, traces or MSHRs\n" );
+    rc = false;
+  }
+
+  // the other models follow the decoupled cache, and only its fills and write-backs go to the DRAM
+  if ( rc && !decouple_models.empty() && (decouple_records == 0 || dram_banks > 0) )
+  {
+    printf( "another cache model needs --decouple, and doesn't work with a DRAM\n" );
+    rc = false;
+  }
+
+  // sectors have to fit the blocks, and only the plain cache tracks them
+  if ( rc && sectors > block_size )
+  {
+    printf( "a block of %d word(s) can't have %d sectors\n", block_size, sectors );
+    rc = false;
+  }
+  if ( rc && sectors > 0 && (victim_blocks > 0 || num_cores > 1 || checkpoint_at > 0 || restore_file != NULL ||
+                             decouple_records > 0) )
+  {
+    printf( "sectors only work with a single core, without a victim cache, checkpoints or decoupling\n" );
+    rc = false;
+  }
+
+  // so do the telemetry windows
+  if ( rc && telemetry_file != NULL && (sample_interval > 0 || trace_file != NULL || decouple_records > 0) )
+  {
+    printf( "telemetry needs every access to go through the cache as it happens, without sampling, traces or decoupling\n" );
+    rc = false;
+  }
+
+  // the timing follows the cache through every access, which sampling skips
+  if ( rc && mshr_count > 0 && (sample_interval > 0 || trace_file != NULL) )
+  {
+    printf( "MSHR timing needs every access to go through the cache, without sampling or traces\n" );
+    rc = false;
+  }
+
+  // every DRAM access takes some time, a block has to come from a single row, and the DRAM follows every
+  // fill and write-back as it happens
+  if ( rc && (dram_hit < 1 || dram_miss < 1 || dram_conflict < 1) )
+  {
+    printf( "the DRAM latencies must be at least 1 cycle\n" );
+    rc = false;
+  }
+  if ( rc && dram_banks > 0 && (dram_row < block_size || dram_row > MAX_DATA_SIZE || (dram_row & (dram_row - 1)) != 0) )
+  {
+    printf( "a DRAM row must be a power of 2 words, at least a block and at most %d\n", MAX_DATA_SIZE );
+    rc = false;
+  }
+  if ( rc && dram_banks > 0 && (mshr_count > 0 || sample_interval > 0 || checkpoint_at > 0 || restore_file != NULL) )
+  {
+    printf( "the DRAM model can't be used with MSHR timing, sampling or checkpoints\n" );
+    rc = false;
+  }
+
+  // a server runs programs, each job has its own files
+  if ( rc && serve_path != NULL &&
+       (checkpoint_at > 0 || restore_file != NULL || trace_file != NULL || layout_prefix != NULL) )
+  {
+    printf( "a server only runs programs, without checkpoints, traces or layouts\n" );
+    rc = false;
+  }
+
+  // the analysis models a plain LRU cache for one core, where the program's addresses go straight to it
+  if ( rc && analyze &&
+       (num_cores > 1 || cache_policy != LRU_POLICY || victim_blocks > 0 || sectors > 0 || tlb_entries > 0 ||
+        remap_file != NULL || trace_file != NULL || checkpoint_at > 0 || restore_file != NULL) )
+  {
+    printf( "the analysis is of a single core's LRU cache, without a victim cache, sectors, virtual memory,\n"
+            "remapping, traces or checkpoints\n" );
+    rc = false;
+  }
+
+  // the programs given with --program take turns with the one on the command line, each in its own slice of
+  // data memory, on a single core with nothing that follows a single program's addresses or code
+  if ( rc && !programs.empty() )
+  {
+    struct PROGRAM first;
+
+    first.code_file = argv[1];
+    first.data_file = argv[2];
+    first.first_block = 0;
+    first.blocks = 0;
+    programs.insert( programs.begin(), first );
+    program_words = (data_size + block_size - 1) / block_size * block_size;
+    for ( i=0 ; i<(int)programs.size() ; i++ )
+      programs[i].base = i * program_words;
+
+    if ( programs.size() > MAX_PROGRAMS || programs.size() * program_words > MAX_DATA_SIZE )
+    {
+      printf( "at most %d programs can take turns, and %d programs of %d words each don't fit in data memory\n",
+              MAX_PROGRAMS, (int)programs.size(), data_size );
+      rc = false;
+    }
+    else if ( num_cores > 1 || victim_blocks > 0 || tlb_entries > 0 || sample_interval > 0 || decouple_records > 0 ||
+              mshr_count > 0 || checkpoint_at > 0 || restore_file != NULL || trace_file != NULL ||
+              layout_prefix != NULL || remap_file != NULL || profile_source != NULL || telemetry_file != NULL ||
+              analyze )
+    {
+      printf( "programs take turns on a single core and cache, without a victim cache, virtual memory, sampling,\n"
+              "decoupling, MSHRs, checkpoints, traces, layouts, profiles, telemetry or analysis\n" );
+      rc = false;
+    }
+  }
+  if ( rc && partition_spec != NULL )
+  {
+    if ( programs.empty() )
+    {
+      printf( "--partition shares the cache between programs given with --program\n" );
+      rc = false;
+    }
+    else
+      rc = partition_cache();
+  }
+
+  // the scratchpad is in front of one core's cache, at the program's own addresses
+  if ( rc && scratchpad_file != NULL &&
+       (num_cores > 1 || !programs.empty() || sample_interval > 0 || decouple_records > 0 || tlb_entries > 0 ||
+        remap_file != NULL || checkpoint_at > 0 || restore_file != NULL || trace_file != NULL ||
+        layout_prefix != NULL || analyze) )
+  {
+    printf( "a scratchpad only works with a single core running one program, without sampling, decoupling,\n"
+            "virtual memory, remapping, checkpoints, traces, layouts or analysis\n" );
+    rc = false;
+  }
+  if ( rc && scratchpad_file != NULL && !read_scratchpad( scratchpad_file ) )
+    rc = false;
+
+  // a stored run has to come out the same every time, and only its output is stored
+  if ( rc && results_path != NULL &&
+       ((num_cores > 1 && threaded) || checkpoint_at > 0 || restore_file != NULL || trace_file != NULL ||
+        layout_prefix != NULL || remap_file != NULL || profile_source != NULL || telemetry_file != NULL) )
+  {
+    printf( "only repeatable runs that just print their results can be stored, so more than one core needs\n"
+            "--schedule round-robin, and there can't be checkpoints, traces, layouts, remapping, profiles or telemetry\n" );
+    rc = false;
+  }
+
+  // a single core never needs to share the bus
+  if ( num_cores == 1 )
+    threaded = false;
+
+  return rc;
+}
+
+
+// waits for the bus when cores are running on their own host threads
+void acquire_bus()
+{
+  if ( threaded )
+    bus.lock();
+}
+
+
+void release_bus()
+{
+  if ( threaded )
+    bus.unlock();
+}
+
+
+// runs the passed core until it stops, this is what each host thread does
+void run_core( struct CORE *the_core )
+{
+  core = the_core;
+
+  while ( core->phase < NUM_PHASES ) {
+    core->phase = control_unit[core->phase]();
+  }
+}
+
+
+// runs the passed core on a host thread of its own, with the cache geometry of the thread that started it
+void run_core_thread( struct CORE *the_core, struct GEOMETRY geometry )
+{
+  use_geometry( &geometry );
+  run_core( the_core );
+}
+
+
+// runs the current core for up to the passed number of instructions, stopping early if the core stops
+void run_instructions( unsigned long count )
+{
+  unsigned long i;
+
+  for ( i=0 ; i<count && core->phase < NUM_PHASES ; i++ )
+  {
+    // a whole instruction is done when we're back to fetching
+    do {
+      core->phase = control_unit[core->phase]();
+    } while ( core->phase != FETCH_INSTR && core->phase < NUM_PHASES );
+  }
+}
+
+
+// switches between the fast functional mode and detailed simulation
+void set_functional( bool on )
+{
+  functional = on;
+
+  if ( functional )
+  {
+    // main memory has to be up to date before we start going around the cache
+    cache_flush( &core->cache );
+    load_data = functional_load;
+    store_data = functional_store;
+  }
+
+  else
+  {
+    // and the cache has to catch up with whatever we wrote while we were away
+    cache_refresh( &core->cache );
+    select_cache_model();
+  }
+}
+
+
+// runs the only core with sampling, fast forwarding between detailed measurement windows
+void run_sampled( struct CORE *the_core )
+{
+  int hits;
+  int misses;
+
+  core = the_core;
+
+  while ( core->phase < NUM_PHASES )
+  {
+    set_functional( true );
+    run_instructions( sample_interval - sample_warmup - sample_window );
+    set_functional( false );
+
+    // the warm-up only gets the cache into shape, it isn't measured
+    run_instructions( sample_warmup );
+
+    hits = core->cache.hits;
+    misses = core->cache.misses;
+    run_instructions( sample_window );
+
+    // a window cut short by the end of the program still counts if it saw anything
+    if ( core->cache.hits + core->cache.misses > hits + misses )
+    {
+      window_hits.push_back( core->cache.hits - hits );
+      window_misses.push_back( core->cache.misses - misses );
+    }
+  }
+}
+
+
+// reports what the sample windows measured and what that means for the whole run.
+// the miss rate is a ratio estimate (window misses over window accesses) with a 95% confidence interval
+void print_sample_statistics( struct CORE *the_core )
+{
+  int n = window_hits.size();
+  int i;
+  double accesses = 0;
+  double missed = 0;
+  double rate = 0;
+  double error = 0;
+  double residual;
+  unsigned long total = the_core->cache.hits + the_core->cache.misses + skipped_accesses;
+
+  for ( i=0 ; i<n ; i++ )
+  {
+    accesses += window_hits[i] + window_misses[i];
+    missed += window_misses[i];
+  }
+
+  if ( accesses > 0 )
+    rate = missed / accesses;
+
+  // standard error of a ratio estimate, which needs at least two windows
+  if ( n > 1 )
+  {
+    for ( i=0 ; i<n ; i++ )
+    {
+      residual = window_misses[i] - rate * (window_hits[i] + window_misses[i]);
+      error += residual * residual;
+    }
+    error = sqrt( error / (n * (n - 1.0)) ) / (accesses / n);
+  }
+
+  printf( "Sampled cache report, %d instruction window(s) every %d instructions after %d to warm up:\n",
+         sample_window, sample_interval, sample_warmup );
+  printf( "Windows: %d\nInstructions: %lu\nMemory accesses: %lu (%.0f measured)\n",
+         n, the_core->instructions, total, accesses );
+  printf( "Estimated miss rate: %.2f%% +/- %.2f%%\n", rate*100, 1.96*error*100 );
+  printf( "Estimated hits: %.0f\nEstimated misses: %.0f\n\n", (1 - rate)*total, rate*total );
+}
+
+
+// runs every core, taking turns an instruction at a time, until they have all run checkpoint_at instructions
+// (or stopped) and then saves the checkpoint. returns false if it couldn't be saved
+bool run_to_checkpoint()
+{
+  vector<unsigned char> image;
+  bool running = true;
+  int i;
+
+  while ( running )
+  {
+    running = false;
+    for ( i=0 ; i<num_cores ; i++ )
+    {
+      core = &cores[i];
+      if ( core->phase < NUM_PHASES && core->instructions < checkpoint_at )
+      {
+        run_instructions( 1 );
+        running = true;
+      }
+    }
+  }
+
+  save_checkpoint( image );
+
+  return write_checkpoint( checkpoint_file, image );
+}
+
+
+// runs every core until they have all stopped
+void run_cores()
+{
+  vector<thread> threads;
+  struct GEOMETRY geometry;
+  int running = num_cores;
+  int i;
+  int j;
+
+  if ( sample_interval > 0 )
+    run_sampled( cores );
+
+  else if ( decouple_records > 0 )
+    run_decoupled( cores );
+
+  else if ( !programs.empty() )
+    run_programs();
+
+  else if ( num_cores == 1 )
+    run_core( cores );
+
+  else if ( threaded )
+  {
+    get_geometry( &geometry );
+    for ( i=0 ; i<num_cores ; i++ )
+      threads.push_back( thread( run_core_thread, &cores[i], geometry ) );
+    for ( i=0 ; i<num_cores ; i++ )
+      threads[i].join();
+  }
+
+  // take turns, quantum instructions at a time
+  else
+  {
+    while ( running > 0 )
+    {
+      for ( i=0 ; i<num_cores ; i++ )
+      {
+        core = &cores[i];
+        for ( j=0 ; j<quantum && core->phase < NUM_PHASES ; j++ )
+        {
+          // a whole instruction is done when we're back to fetching
+          do {
+            core->phase = control_unit[core->phase]();
+          } while ( core->phase != FETCH_INSTR && core->phase < NUM_PHASES );
+
+          if ( core->phase >= NUM_PHASES )
+            running--;
+        }
+      }
     }
   }
 }
 
 
-// Prints report indicating the cache hits, misses and hit rate achieved
-void print_statistics()
+// output what stopped the passed core
+void print_stop_reason( struct CORE *the_core )
 {
-  // if program does loads or stores, report the hits, misses and overall hit rate
-  // if program does no loads or stores, report the hits as 0, misses as 0 and overall hit rate as 0.00 (This is done to prevent div by 0 error)
-  if( hits + misses > 0 )
+  switch( the_core->phase )
   {
-    printf( "Cache report for fully associative cache with %d block(s) of %d word(s) each:\n", CACHE_BLOCKS, BLOCK_SIZE);
-    printf( "Hits: %d\nMisses: %d\n", hits, misses);
-    printf( "Overall hit rate: %.2f%%\n\n", ((float)hits / (float)(hits + misses))*100);
-  } 
-  else 
+    case ILLEGAL_OPCODE:
+      printf( "Illegal instruction %02x%02x detected at address %04x\n\n",
+             the_core->state.IR[0], the_core->state.IR[1], the_core->state.PC );
+      break;
+      
+    case INFINITE_LOOP:
+      printf( "Possible infinite loop detected with instruction %02x%02x at address %04x\n\n",
+             the_core->state.IR[0], the_core->state.IR[1], the_core->state.PC );
+      break;
+      
+    case ILLEGAL_ADDRESS:
+      printf( "Illegal address %04x detected with instruction %02x%02x at address %04x\n\n",
+             the_core->state.MAR, the_core->state.IR[0], the_core->state.IR[1], the_core->state.PC );
+      break;
+      
+    default:
+      break;
+  }
+}
+
+
+// reports on each core and what stopped it
+void print_reports()
+{
+  int i;
+
+  for ( i=0 ; i<num_cores ; i++ )
   {
-    printf( "Cache report for fully associative cache with %d block(s) of %d word(s) each:\n", CACHE_BLOCKS, BLOCK_SIZE);
-    printf( "Hits: %d\nMisses: %d\n", hits, misses);
-    printf( "Overall hit rate: %.2f%%\n\n", 0.0);
+    if ( num_cores > 1 )
+      printf( "Core %d:\n", i );
+
+    // with sampling the cache only saw part of the run, the estimate is what matters
+    if ( sample_interval > 0 )
+      print_sample_statistics( &cores[i] );
+    else
+      print_statistics( &cores[i].cache );
+
+    if ( scratchpad_file != NULL )
+      print_scratchpad( &cores[i] );
+
+    // the TLB sits in front of the cache so report it alongside
+    if ( tlb_entries > 0 )
+      print_tlb_statistics( &cores[i].tlb );
+
+    if ( mshr_count > 0 )
+      print_timing( &cores[i] );
+
+    // each program that took turns stopped for its own reason
+    if ( !programs.empty() )
+      print_programs();
+    else
+      print_stop_reason( &cores[i] );
+  }
+
+  // the other cache models of a decoupled run saw the same accesses as the first core's cache
+  if ( !decouple_models.empty() )
+    print_models();
+
+  // the cores share main memory
+  if ( dram_banks > 0 )
+    print_dram();
+
+  if ( profile_source != NULL )
+    print_profile();
+
+  if ( telemetry != NULL )
+    finish_telemetry();
+}
+
+
+// restores the checkpoint into a run for each line of options in the fork file. each run starts from the
+// settings on the command line, and only the cache and sampling options make sense since everything else
+// comes from the checkpoint
+void run_forks( const char *program, const vector<unsigned char> &image )
+{
+  std::ifstream fork_options( fork_file );
+  std::string line;
+  vector<char> words;
+  vector<const char *> args;
+  char *word;
+  int run = 0;
+  int i;
+
+  if ( !fork_options.is_open() )
+    printf( "couldn't open the fork file %s\n", fork_file );
+
+  save_settings();
+  while ( getline( fork_options, line ) )
+  {
+    if ( line.empty() )
+      continue;
+
+    restore_settings();
+
+    // parse_options() expects the program and file names first
+    words.assign( line.begin(), line.end() );
+    words.push_back( '\0' );
+    args.assign( 3, program );
+    for ( word=strtok( &words[0], " \t\r" ) ; word!=NULL ; word=strtok( NULL, " \t\r" ) )
+      args.push_back( word );
+
+    printf( "Run %d: %s\n", ++run, line.c_str() );
+    if ( !parse_options( args.size(), &args[0] ) )
+      continue;
+
+    if ( !restore_checkpoint( image ) )
+    {
+      printf( "the checkpoint is damaged\n" );
+      break;
+    }
+    if ( sample_interval > 0 && num_cores > 1 )
+    {
+      printf( "sampling only works with a single core\n" );
+      continue;
+    }
+
+    run_cores();
+    for ( i=0 ; i<num_cores ; i++ )
+      cache_flush( &cores[i].cache );
+    print_reports();
   }
 }
 
 
 ////////////////////////////////////////////////////////////////////
-// general routines
+// result store routines
 
+// with --results a run's output (its statistics, what stopped it and the data memory) is kept in a directory,
+// in a file named for a hash of the code, the data and every setting that can change the output. running the
+// same thing again prints the stored output instead of simulating. the first line of the file is the settings
+// it was stored for, so a hash that happens to match something else isn't mistaken for it. the simulator's
+// build is part of the settings, so a rebuilt simulator never returns an older one's results.
 
-// Initialize memory and registers with default values (0xFF and 0 respectively)
-void initialize_system()
+
+// hashes more bytes into a 64-bit FNV-1a hash
+unsigned long long hash_bytes( unsigned long long hash, const void *bytes, size_t length )
+{
+  const unsigned char *byte = (const unsigned char *)bytes;
+  size_t i;
+
+  for ( i=0 ; i<length ; i++ )
+  {
+    hash ^= byte[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+
+// describes every setting that can change a run's output, on one line
+string result_settings()
+{
+  char text[LINE_LENGTH*64];
+  string settings;
+  size_t i;
+
+  snprintf( text, sizeof(text), "build %s %s, m %d, b %d, s %d, policy %d, victim %d, sectors %d, "
+            "sample %d/%d/%d, tlb %d/%d/%d/%d, cores %d, threads %d, quantum %d, decouple %d, mshrs %d/%d, "
+            "analyze %d/%d, partition %s, scratchpad %d, dram %d/%d/%d/%d/%d/%d/%d",
+            __DATE__, __TIME__, data_size, cache_blocks, block_size, cache_policy, victim_blocks, sectors,
+            sample_interval, sample_warmup, sample_window, tlb_entries, tlb_ways, tlb_policy, walk_cycles,
+            num_cores, threaded && num_cores > 1, quantum, decouple_records > 0, mshr_count, miss_cycles,
+            analyze, analyze_any, partition_spec != NULL ? partition_spec : "none",
+            scratchpad_file != NULL, dram_banks, dram_row, dram_closed_page, dram_block_map, dram_hit, dram_miss,
+            dram_conflict );
+  settings = text;
+
+  for ( i=1 ; i<programs.size() ; i++ )
+    settings += ", program " + programs[i].code_file + "," + programs[i].data_file;
+  for ( i=0 ; i<decouple_models.size() ; i++ )
+  {
+    snprintf( text, sizeof(text), ", model %dx%d", decouple_models[i].blocks, decouple_models[i].words );
+    settings += text;
+  }
+
+  return settings;
+}
+
+
+// works out the key a run is stored under, the hash of its settings and the contents of its files
+// returns false if a file can't be read
+bool result_key( const char *code_filename, const char *data_filename, const string &settings, string &key )
+{
+  unsigned long long hash = 14695981039346656037ULL;
+  vector<string> files;
+  string contents;
+  size_t length;
+  size_t i;
+  char text[17];
+
+  files.push_back( code_filename );
+  files.push_back( data_filename );
+  for ( i=1 ; i<programs.size() ; i++ )
+  {
+    files.push_back( programs[i].code_file );
+    files.push_back( programs[i].data_file );
+  }
+  if ( scratchpad_file != NULL )
+    files.push_back( scratchpad_file );
+
+  // each file's length goes in first, so moving bytes from one file to the next changes the hash
+  for ( i=0 ; i<files.size() ; i++ )
+  {
+    if ( !read_file( files[i].c_str(), contents ) )
+      return false;
+    length = contents.length();
+    hash = hash_bytes( hash, &length, sizeof(length) );
+    hash = hash_bytes( hash, contents.data(), length );
+  }
+  hash = hash_bytes( hash, settings.data(), settings.length() );
+
+  snprintf( text, sizeof(text), "%016llx", hash );
+  key = text;
+
+  return true;
+}
+
+
+// reads the stored output for the passed settings into output
+// returns false if there isn't one
+bool find_result( const string &file_name, const string &settings, string &output )
+{
+  std::ifstream file( file_name.c_str(), std::ios::binary );
+  std::ostringstream text;
+  string line;
+
+  if ( !file.is_open() || !getline( file, line ) || line != settings )
+    return false;
+
+  text << file.rdbuf();
+  output = text.str();
+
+  return true;
+}
+
+
+// runs the program in the passed files with what we print going to the passed file instead of stdout
+void capture_run( const char *code_filename, const char *data_filename, int capture )
 {
+  int console;
   int i;
-  int j;
-  
-  state.PC = 0;
-  state.MDR = 0;
-  state.MAR = 0;
-  state.ALU_x = 0;
-  state.ALU_y = 0;
-  state.ALU_z = 0;
 
-  // intializes hit and miss tracking
- 	hits = 0;
-  misses = 0;
+  fflush( stdout );
+  console = dup( STDOUT_FILENO );
+  dup2( capture, STDOUT_FILENO );
 
-  // initialize the least recently used global counter
-  lru_global_counter = 0;
-  
-  // fill all of our code and data space
-  for ( i=0 ; i<CODE_SIZE ; i++ )
+  initialize_system();
+  if ( !load_files( code_filename, data_filename ) )
+    printf( "couldn't read %s and %s\n", code_filename, data_filename );
+  else if ( analyze )
+    analyze_cache( data_filename );
+  else
   {
-    code[i][0] = MEM_FILLER;
-    code[i][1] = MEM_FILLER;
+    run_cores();
+    for ( i=0 ; i<num_cores ; i++ )
+      cache_flush( &cores[i].cache );
+    print_reports();
+    print_data_memory();
   }
 
-  for ( i=0 ; i<DATA_BLOCKS ; i++ ) {
-  	for (j = 0; j < BLOCK_SIZE; j++)
-		  {
-		    data[i][j][0] = MEM_FILLER;
-		    data[i][j][1] = MEM_FILLER;
-		  }
+  fflush( stdout );
+  dup2( console, STDOUT_FILENO );
+  close( console );
+}
+
+
+// prints the stored output of a run, running and storing it first if it isn't there.
+// to verify, the run is done again and compared with the stored output
+void run_stored( const char *code_filename, const char *data_filename )
+{
+  string settings = result_settings();
+  string key;
+  string file_name;
+  string stored;
+  string output;
+  string temporary;
+  string line;
+  std::ifstream fresh;
+  std::ostringstream text;
+  bool found;
+  int capture;
+
+  if ( !result_key( code_filename, data_filename, settings, key ) )
+  {
+    printf( "couldn't read the files for %s and %s\n", code_filename, data_filename );
+    return;
   }
-  
-  // initialize our registers
-  for ( i=0 ; i<REGISTERS ; i++ )
-    registers[i] = 0;
+  file_name = string( results_path ) + "/" + key + ".result";
+  found = find_result( file_name, settings, stored );
 
-	// initialize the valid bit, dirty bit and value used to track the reference count
-  // for every cache block in the cache directory
-  for ( i=0 ; i<CACHE_BLOCKS ; i++ )
+  if ( found && results_mode == USE_RESULTS )
   {
-	 	cache_directory[i].valid = false;
-	  cache_directory[i].dirty = false;
-    cache_directory[i].reference_count = 0;
+    fwrite( stored.data(), 1, stored.length(), stdout );
+    return;
   }
 
-  // fill our cache memory array with invalid data
-  for (i = 0; i < CACHE_BLOCKS; i ++){
-  	for (j = 0; j < BLOCK_SIZE; j++) {
-  		cache_memory[i][j][0] = MEM_FILLER;
-  		cache_memory[i][j][1] = MEM_FILLER;
-  	}
+  // run it into a temporary file that starts with the settings, which becomes the stored result
+  temporary = string( results_path ) + "/" + key + ".XXXXXX";
+  capture = mkstemp( &temporary[0] );
+  if ( capture < 0 )
+  {
+    printf( "couldn't write a result to %s\n", results_path );
+    return;
+  }
+  settings += "\n";
+  if ( write( capture, settings.data(), settings.length() ) != (ssize_t)settings.length() )
+    printf( "couldn't write a result to %s\n", results_path );
+  capture_run( code_filename, data_filename, capture );
+  close( capture );
+
+  fresh.open( temporary.c_str(), std::ios::binary );
+  getline( fresh, line );
+  text << fresh.rdbuf();
+  output = text.str();
+  fwrite( output.data(), 1, output.length(), stdout );
+
+  // verifying leaves the stored result alone, unless there wasn't one
+  if ( found && results_mode == VERIFY_RESULTS )
+  {
+    unlink( temporary.c_str() );
+    printf( "%s the stored result %s\n", output == stored ? "Matches" : "Differs from", file_name.c_str() );
+  }
+  else if ( rename( temporary.c_str(), file_name.c_str() ) != 0 )
+  {
+    unlink( temporary.c_str() );
+    printf( "couldn't store the result as %s\n", file_name.c_str() );
   }
 }
 
 
-// checks the hex value to ensure it a printable ASCII character. If
-// it isn't, '.' is returned instead of itself
-char valid_ascii( unsigned char hex_value )
+////////////////////////////////////////////////////////////////////
+// server routines
+
+// a server stays up and runs one job after another, which saves starting a process for every run and
+// reading the same files again. each job is a line with the code and data files and any options, which
+// start from the server's own settings. the job's reports go back the way it came, followed by a line
+// saying the job is done. the data memory isn't printed.
+
+// the settings a job or forked run starts from, the ones on the command line
+struct SETTINGS
 {
-  if ( hex_value < 0x21 || hex_value > 0x7e )
-    hex_value = '.';
-  
-  return (char)hex_value;
+  int    data_size;
+  int    cache_blocks;
+  int    block_size;
+  Policy cache_policy;
+  int    victim_blocks;
+  int    sample_interval;
+  int    sample_warmup;
+  int    sample_window;
+  int    tlb_entries;
+  int    tlb_ways;
+  Policy tlb_policy;
+  int    walk_cycles;
+  int    num_cores;
+  bool   threaded;
+  int    quantum;
+  int    decouple_records;
+  vector<struct GEOMETRY> decouple_models;
+  int    mshr_count;
+  int    miss_cycles;
+  int    sectors;
+  int    telemetry_window;
+  bool   window_by_accesses;
+  const char *telemetry_file;
+  const char *remap_file;
+  const char *profile_source;
+  bool   analyze;
+  bool   analyze_any;
+  const char *partition_spec;
+  const char *results_path;
+  ResultMode  results_mode;
+  const char *scratchpad_file;
+  int    dram_banks;
+  int    dram_row;
+  bool   dram_closed_page;
+  bool   dram_block_map;
+  int    dram_hit;
+  int    dram_miss;
+  int    dram_conflict;
+};
+
+static struct SETTINGS base_settings;
+
+
+// remembers the current settings as the ones every job or forked run starts from
+void save_settings()
+{
+  base_settings.data_size = data_size;
+  base_settings.cache_blocks = cache_blocks;
+  base_settings.block_size = block_size;
+  base_settings.cache_policy = cache_policy;
+  base_settings.victim_blocks = victim_blocks;
+  base_settings.sample_interval = sample_interval;
+  base_settings.sample_warmup = sample_warmup;
+  base_settings.sample_window = sample_window;
+  base_settings.tlb_entries = tlb_entries;
+  base_settings.tlb_ways = tlb_ways;
+  base_settings.tlb_policy = tlb_policy;
+  base_settings.walk_cycles = walk_cycles;
+  base_settings.num_cores = num_cores;
+  // a single core turns threads off, which a job with more cores shouldn't inherit, so keep the schedule given
+  base_settings.threaded = schedule_threads;
+  base_settings.quantum = quantum;
+  base_settings.decouple_records = decouple_records;
+  base_settings.decouple_models = decouple_models;
+  base_settings.mshr_count = mshr_count;
+  base_settings.sectors = sectors;
+  base_settings.telemetry_window = telemetry_window;
+  base_settings.window_by_accesses = window_by_accesses;
+  base_settings.telemetry_file = telemetry_file;
+  base_settings.miss_cycles = miss_cycles;
+  base_settings.remap_file = remap_file;
+  base_settings.profile_source = profile_source;
+  base_settings.analyze = analyze;
+  base_settings.analyze_any = analyze_any;
+  base_settings.partition_spec = partition_spec;
+  base_settings.results_path = results_path;
+  base_settings.results_mode = results_mode;
+  base_settings.scratchpad_file = scratchpad_file;
+  base_settings.dram_banks = dram_banks;
+  base_settings.dram_row = dram_row;
+  base_settings.dram_closed_page = dram_closed_page;
+  base_settings.dram_block_map = dram_block_map;
+  base_settings.dram_hit = dram_hit;
+  base_settings.dram_miss = dram_miss;
+  base_settings.dram_conflict = dram_conflict;
 }
 
 
-// takes the data and prints it out in hexadecimal and ASCII form
-void print_memory()
+// puts the command line settings back before a job or forked run
+void restore_settings()
 {
-  int count = 0;
-  int ix = 0;
-  int jx = 0;
-  int text_index = 0;
-  char the_text[LINE_LENGTH+1];
+  data_size = base_settings.data_size;
+  cache_blocks = base_settings.cache_blocks;
+  block_size = base_settings.block_size;
+  cache_policy = base_settings.cache_policy;
+  victim_blocks = base_settings.victim_blocks;
+  sample_interval = base_settings.sample_interval;
+  sample_warmup = base_settings.sample_warmup;
+  sample_window = base_settings.sample_window;
+  tlb_entries = base_settings.tlb_entries;
+  tlb_ways = base_settings.tlb_ways;
+  tlb_policy = base_settings.tlb_policy;
+  walk_cycles = base_settings.walk_cycles;
+  num_cores = base_settings.num_cores;
+  threaded = schedule_threads = base_settings.threaded;
+  quantum = base_settings.quantum;
+  decouple_records = base_settings.decouple_records;
+  decouple_models = base_settings.decouple_models;
+  mshr_count = base_settings.mshr_count;
+  sectors = base_settings.sectors;
+  telemetry_window = base_settings.telemetry_window;
+  window_by_accesses = base_settings.window_by_accesses;
+  telemetry_file = base_settings.telemetry_file;
+  miss_cycles = base_settings.miss_cycles;
+  remap_file = base_settings.remap_file;
+  profile_source = base_settings.profile_source;
+  analyze = base_settings.analyze;
+  analyze_any = base_settings.analyze_any;
+  partition_spec = base_settings.partition_spec;
+  results_path = base_settings.results_path;
+  results_mode = base_settings.results_mode;
+  scratchpad_file = base_settings.scratchpad_file;
+  dram_banks = base_settings.dram_banks;
+  dram_row = base_settings.dram_row;
+  dram_closed_page = base_settings.dram_closed_page;
+  dram_block_map = base_settings.dram_block_map;
+  dram_hit = base_settings.dram_hit;
+  dram_miss = base_settings.dram_miss;
+  dram_conflict = base_settings.dram_conflict;
+  scratchpad_words = 0;
+  programs.clear();
+  remap.clear();
+}
 
-  // print each line 1 at a time
-  for ( ix=0 ; ix<DATA_BLOCKS ; ix++ ) {
-  	for (jx = 0; jx < BLOCK_SIZE; jx++) {
-  		if ( text_index == 0 )
-		  {
-		    // for each word we're printing 2 bytes, so the counter
-		    // should be twice count.
-		    printf( "%08x  ", count*2 );
-		  }
 
-		  the_text[text_index++] = valid_ascii((unsigned char)(data[ix][jx][0]));
-	    the_text[text_index++] = valid_ascii((unsigned char)(data[ix][jx][1]));
-	    printf( "%02x %02x ", data[ix][jx][0], data[ix][jx][1] );
+// runs a job line, the code and data files followed by any options
+void run_job( const char *program, const string &line, int job )
+{
+  vector<char> words;
+  vector<const char *> args;
+  char *word;
+  int i;
+
+  restore_settings();
 
-      count++;
-    }
+  // parse_options() expects the program name first
+  words.assign( line.begin(), line.end() );
+  words.push_back( '\0' );
+  args.push_back( program );
+  for ( word=strtok( &words[0], " \t\r" ) ; word!=NULL ; word=strtok( NULL, " \t\r" ) )
+    args.push_back( word );
 
-    // print out a line if we're at the end
-    if ( text_index == LINE_LENGTH )
+  printf( "Job %d: %s\n", job, line.c_str() );
+  if ( parse_options( args.size(), &args[0] ) )
+  {
+    if ( checkpoint_at > 0 || restore_file != NULL || fork_file != NULL || trace_file != NULL ||
+         layout_prefix != NULL || serve_path != NULL )
+      printf( "a job only runs a program, without checkpoints, traces, layouts or another server\n" );
+
+    else if ( results_path != NULL )
+      run_stored( args[1], args[2] );
+
+    else
     {
-      text_index = 0;
-      the_text[LINE_LENGTH] = '\0';
-      printf( " |%s|\n", the_text );
+      initialize_system();
+      if ( !load_files( args[1], args[2] ) )
+        printf( "couldn't read %s and %s\n", args[1], args[2] );
+      else if ( analyze )
+        analyze_cache( args[2] );
+      else
+      {
+        run_cores();
+        for ( i=0 ; i<num_cores ; i++ )
+          cache_flush( &cores[i].cache );
+        print_reports();
+      }
     }
   }
+
+  // a job that failed or stopped before its reports mustn't leave its telemetry open for the next one
+  close_telemetry();
+
+  // options that are only for the command line don't carry over to the next job
+  checkpoint_at = 0;
+  checkpoint_file = NULL;
+  restore_file = NULL;
+  fork_file = NULL;
+  trace_file = NULL;
+  layout_prefix = NULL;
+  serve_path = NULL;
+
+  printf( "End of job %d\n", job );
+  fflush( stdout );
 }
 
 
-// converts the passed string into binary form and inserts it into our data area
-// assumes an even number of words!!!
-void insert_data( string line )
+// runs every job line from the passed stream until it ends or a line says quit
+// returns false if it was told to quit
+bool serve_jobs( FILE *jobs, const char *program, int &job )
 {
-  unsigned int  i;
-  char          ascii_data[5];
-  unsigned char byte1;
-  unsigned char byte2;
-  
-  ascii_data[4] = '\0';
-  
-  static int blocks = 0;   // block counter in main memory
-  static int words = 0;    // word counter in a block in main memory
-
+  char line[LINE_LENGTH*64];
+  string text;
 
-  for (i=0 ; i<line.length() ; i+=4 )
+  while ( fgets( line, sizeof(line), jobs ) != NULL )
   {
-  	ascii_data[0] = line[i];
-    ascii_data[1] = line[i+1];
-    ascii_data[2] = line[i+2];
-    ascii_data[3] = line[i+3];
-      
-    sscanf(ascii_data, "%02hhx%02hhx", &byte1, &byte2);
+    text = line;
+    text.erase( text.find_last_not_of( " \t\r\n" ) + 1 );
 
-    // Fills up a block in main memory before moving to next block
-    if ( blocks < DATA_BLOCKS ) {
-      if ( words < BLOCK_SIZE ) {
-        data[blocks][words][0] = byte1;
-        data[blocks][words][1] = byte2;
-      } 
-      words++;
+    if ( text == "quit" )
+      return false;
+    if ( !text.empty() )
+      run_job( program, text, ++job );
 
-      // If we have filled up a block in main memory with enough words, move to the next block 
-      if ( words >= BLOCK_SIZE ) {
-      	blocks++;
-      	words = 0;
-    	}
-    }    
+    // a client that hung up can't have any more reports, writing to it fails with EPIPE
+    fflush( stdout );
+    if ( ferror( stdout ) )
+      break;
   }
+
+  return true;
 }
 
 
-// reads in the file data and returns true is our code and data areas are ready for processing
-bool load_files( const char *code_filename, const char *data_filename )
+// serves jobs from stdin, or from each connection to the Unix socket in turn with the reports
+// going back over the connection
+void run_server( const char *program )
 {
-  FILE           *code_file = NULL;
-  std::ifstream  data_file( data_filename );
-  string         line;           // used to read in a line of text
-  bool           rc = false;
-  
-  // using RAW C here since I want to have straight binary access to the data
-  code_file = fopen( code_filename, "r" );
-  
-  // since we're allowing anything to be specified, make sure it's a file...
-  if ( code_file )
+  const char *path = serve_path;
+  struct sockaddr_un address;
+  struct stat status;
+  int listener;
+  int connection;
+  int console = dup( STDOUT_FILENO );
+  int job = 0;
+  bool serving = true;
+  FILE *jobs;
+
+  save_settings();
+  serve_path = NULL;
+
+  if ( strcmp( path, "-" ) == 0 )
   {
-    // put the code into the code area
-    fread( code, 1, CODE_SIZE*WORD_SIZE, code_file );
-    
-    fclose( code_file );
-    
-    // since we're allowing anything to be specified, make sure it's a file...
-    if ( data_file.is_open() )
-    {
-      // read the data into our data area
-      getline( data_file, line );
-      while ( !data_file.eof() )
-      {
-        // put the data into the data area
-        insert_data( line );
-        
-        getline( data_file, line );
-      }
-      data_file.close();
-      
-      // both files were read so we can continue processing
-      rc = true;
-    }
+    serve_jobs( stdin, program, job );
+    return;
   }
-  
-  return rc;
+
+  // only an old socket is cleared away, never somebody's file
+  if ( lstat( path, &status ) == 0 && !S_ISSOCK( status.st_mode ) )
+  {
+    printf( "%s is already there and isn't a socket\n", path );
+    return;
+  }
+
+  memset( &address, 0, sizeof(address) );
+  address.sun_family = AF_UNIX;
+  strncpy( address.sun_path, path, sizeof(address.sun_path) - 1 );
+  unlink( path );
+
+  // a client that hangs up mid report mustn't take the server down with it
+  signal( SIGPIPE, SIG_IGN );
+
+  listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( listener < 0 || bind( listener, (struct sockaddr *)&address, sizeof(address) ) != 0 ||
+       listen( listener, 1 ) != 0 )
+  {
+    printf( "couldn't listen on %s\n", path );
+    return;
+  }
+  printf( "serving jobs on %s\n", path );
+  fflush( stdout );
+
+  while ( serving && (connection = accept( listener, NULL, NULL )) >= 0 )
+  {
+    // everything we print goes to the connection until it's done
+    dup2( connection, STDOUT_FILENO );
+    jobs = fdopen( connection, "r" );
+    serving = serve_jobs( jobs, program, job );
+    fflush( stdout );
+    clearerr( stdout );
+    dup2( console, STDOUT_FILENO );
+    fclose( jobs );
+  }
+
+  close( listener );
+  unlink( path );
 }
 
 
 // runs our simulation after initializing our memory
 int main (int argc, const char * argv[])
 {
-  Phase current_phase = FETCH_INSTR;  // we always start if an instruction fetch
-  
-  initialize_system();
-  
-  // read in our code and data
-  if ( load_files( argv[1], argv[2] ) )
+  int i;
+  bool ready;
+  vector<unsigned char> image;
+
+  // read in our settings, code and data
+  if ( parse_options( argc, argv ) )
   {
-    // run our simulator
-    while ( current_phase < NUM_PHASES ) {
-      current_phase = control_unit[current_phase]();
+    if ( restore_file != NULL && !read_checkpoint( restore_file, image ) )
+      return 1;
+
+    if ( fork_file != NULL )
+    {
+      run_forks( argv[0], image );
+      return 0;
     }
 
-    cache_flush();
-    print_statistics();
-    
-    // output what stopped the simulator
-    switch( current_phase )
+    if ( serve_path != NULL )
     {
-      case ILLEGAL_OPCODE:
-        printf( "Illegal instruction %02x%02x detected at address %04x\n\n",
-               state.IR[0], state.IR[1], state.PC );
-        break;
-        
-      case INFINITE_LOOP:
-        printf( "Possible infinite loop detected with instruction %02x%02x at address %04x\n\n",
-               state.IR[0], state.IR[1], state.PC );
-        break;
-        
-      case ILLEGAL_ADDRESS:
-        printf( "Illegal address %04x detected with instruction %02x%02x at address %04x\n\n",
-               state.MAR, state.IR[0], state.IR[1], state.PC );
-        break;
-        
-      default:
-        break;
+      run_server( argv[0] );
+      return 0;
+    }
+
+    // a stored run is printed from the store, or run into it
+    if ( results_path != NULL )
+    {
+      run_stored( argv[1], argv[2] );
+      return 0;
+    }
+
+    // a trace only has addresses, so there's no program to stop and no data memory worth printing
+    if ( trace_file != NULL )
+    {
+      initialize_system();
+      if ( run_trace() )
+      {
+        print_trace_statistics();
+        print_statistics( &cores[0].cache );
+        if ( tlb_entries > 0 )
+          print_tlb_statistics( &cores[0].tlb );
+        if ( dram_banks > 0 )
+          print_dram();
+      }
+      return 0;
+    }
+
+    // a checkpoint replaces the code and data files
+    if ( restore_file != NULL )
+    {
+      ready = restore_checkpoint( image );
+      if ( !ready )
+        printf( "the checkpoint in %s is damaged\n", restore_file );
+      else if ( sample_interval > 0 && num_cores > 1 )
+      {
+        printf( "sampling only works with a single core\n" );
+        ready = false;
+      }
+    }
+    else
+    {
+      initialize_system();
+      ready = load_files( argv[1], argv[2] );
+    }
+
+    // the analysis doesn't run anything
+    if ( ready && analyze )
+      analyze_cache( argv[2] );
+
+    else if ( ready && (checkpoint_at == 0 || run_to_checkpoint()) )
+    {
+      // run our simulator
+      run_cores();
+
+      for ( i=0 ; i<num_cores ; i++ )
+        cache_flush( &cores[i].cache );
+
+      print_reports();
+
+      if ( layout_prefix != NULL )
+        advise_layout( argv[2] );
+
+      // print out the data area
+      print_data_memory();
     }
-    
-    // print out the data area
-    print_memory();
   }
 }
@@ -0,0 +1,16 @@
+        MOVE R1,0
+        MOVE R5,[R1]
+        BEQ  R5,other
+        MOVE R4,4
+        MOVE R3,[R4]
+        MOVE R7,0
+        BEQ  R7,join
+other:  MOVE R4,0
+        MOVE R3,[R4]
+join:   MOVE R2,2
+        MOVE R3,[R2]
+        MOVE R3,[R4]
+        MOVE R2,6
+        MOVE R3,[R2]
+        MOVE R2,0
+        MOVE R3,[R2]
@@ -0,0 +1,16 @@
+        MOVE R2,0
+        MOVE R1,[R2]
+sat:    PADDS R1,1
+pack:   POR  R1,4
+        MOVE [R2],R1
+        MOVE R2,1
+        MOVE R3,[R2]
+        PSUBS R3,R1
+        PXOR R3,15
+        MOVE [R2],R3
+        MOVE R2,2
+        MOVE R4,[R2]
+        PADD R4,R1
+        PAND R4,14
+        PSUB R4,1
+        MOVE [R2],R4